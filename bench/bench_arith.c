@@ -0,0 +1,132 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Wrapping, saturating, and checked arithmetic over arrays
+
+#include "ulbench.h"
+#include "addwrap.h"
+#include "satcheck.h"
+
+#define NELEM    65536
+
+typedef struct arithdata {
+    short  *s16a, *s16b, *s16d;
+    int    *i32a, *i32b, *i32d;
+} arithdata;
+
+
+// uladdwrapint() as it was, with comparisons and a three-way ternary
+static int legacy_addwrapint(int a, int b) {
+    return ((a<0 && b<INT_MIN-a) ? (INT_MAX+(b-(INT_MIN-a)+1)) :
+            (a>0 && b>INT_MAX-a) ? (INT_MIN+(b-(INT_MAX-a)-1)) :
+            (a + b));
+}
+
+static short legacy_addwrapshort(short a, short b) {
+    return (short)((a<0 && b<SHRT_MIN-a) ? (SHRT_MAX+(b-(SHRT_MIN-a)+1)) :
+                   (a>0 && b>SHRT_MAX-a) ? (SHRT_MIN+(b-(SHRT_MAX-a)-1)) :
+                   (a + b));
+}
+
+
+#define ARITHBM(fname, T, a, b, dst, ...)                                      \
+static void fname(void *ctx, size_t iters) {                                   \
+    arithdata *d = ctx;                                                        \
+    const T *A = d->a, *B = d->b;                                              \
+    T *D = d->dst;                                                             \
+    for (size_t it = 0; it < iters; it++) {                                    \
+        __VA_ARGS__;                                                           \
+        ulBENCH_CLOBBER();                                                     \
+    }                                                                          \
+    (void)A; (void)B; (void)D;                                                 \
+}
+
+ARITHBM(bm_wrap32_legacy, int, i32a, i32b, i32d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = legacy_addwrapint(A[i], B[i]))
+ARITHBM(bm_wrap32_scalar, int, i32a, i32b, i32d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = uladdwrap(A[i], B[i]))
+ARITHBM(bm_wrap32_n, int, i32a, i32b, i32d,
+        uladdwrap_n(D, A, B, NELEM))
+ARITHBM(bm_wrap32_reduce_loop, int, i32a, i32b, i32d,
+        int s = 0; for (size_t i = 0; i < NELEM; i++) s = uladdwrap(s, A[i]); ulBENCH_KEEP(s))
+ARITHBM(bm_wrap32_reduce, int, i32a, i32b, i32d,
+        ulBENCH_KEEP(uladdwrap_reduce(A, NELEM)))
+
+ARITHBM(bm_wrap16_legacy, short, s16a, s16b, s16d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = legacy_addwrapshort(A[i], B[i]))
+ARITHBM(bm_wrap16_scalar, short, s16a, s16b, s16d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = uladdwrap(A[i], B[i]))
+ARITHBM(bm_wrap16_n, short, s16a, s16b, s16d,
+        uladdwrap_n(D, A, B, NELEM))
+
+// Saturating counter updates, against the hand-written guard they replace
+ARITHBM(bm_sat32_guard, int, i32a, i32b, i32d,
+        for (size_t i = 0; i < NELEM; i++) {
+            int a = A[i], b = B[i];
+            D[i] = (b > 0 && a > INT_MAX - b) ? INT_MAX :
+                   (b < 0 && a < INT_MIN - b) ? INT_MIN : a + b;
+        })
+ARITHBM(bm_sat32_scalar, int, i32a, i32b, i32d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = uladdsat(A[i], B[i]))
+ARITHBM(bm_sat32_n, int, i32a, i32b, i32d,
+        uladdsat_n(D, A, B, NELEM))
+ARITHBM(bm_sat16_scalar, short, s16a, s16b, s16d,
+        for (size_t i = 0; i < NELEM; i++) D[i] = uladdsat(A[i], B[i]))
+ARITHBM(bm_sat16_n, short, s16a, s16b, s16d,
+        uladdsat_n(D, A, B, NELEM))
+
+
+void bench_arith(void) {
+    arithdata d;
+    uint64_t s = 99;
+
+    d.s16a = malloc(NELEM * sizeof *d.s16a);
+    d.s16b = malloc(NELEM * sizeof *d.s16b);
+    d.s16d = malloc(NELEM * sizeof *d.s16d);
+    d.i32a = malloc(NELEM * sizeof *d.i32a);
+    d.i32b = malloc(NELEM * sizeof *d.i32b);
+    d.i32d = malloc(NELEM * sizeof *d.i32d);
+    if (!d.s16a || !d.s16b || !d.s16d || !d.i32a || !d.i32b || !d.i32d) abort();
+
+    for (size_t i = 0; i < NELEM; i++) {
+        d.s16a[i] = (short)ulbench_rand(&s);
+        d.s16b[i] = (short)ulbench_rand(&s);
+        d.i32a[i] = (int)ulbench_rand(&s);
+        d.i32b[i] = (int)ulbench_rand(&s);
+    }
+
+    ulbench_run("addwrap/int/legacy-loop",     bm_wrap32_legacy,      &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addwrap/int/uladdwrap-loop",  bm_wrap32_scalar,      &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addwrap/int/uladdwrap_n",     bm_wrap32_n,           &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addwrap/int/reduce-loop",     bm_wrap32_reduce_loop, &d, 1.0 * NELEM * sizeof(int));
+    ulbench_run("addwrap/int/uladdwrap_reduce", bm_wrap32_reduce,     &d, 1.0 * NELEM * sizeof(int));
+    ulbench_run("addwrap/short/legacy-loop",   bm_wrap16_legacy,      &d, 2.0 * NELEM * sizeof(short));
+    ulbench_run("addwrap/short/uladdwrap-loop", bm_wrap16_scalar,     &d, 2.0 * NELEM * sizeof(short));
+    ulbench_run("addwrap/short/uladdwrap_n",   bm_wrap16_n,           &d, 2.0 * NELEM * sizeof(short));
+    ulbench_run("addsat/int/guard-loop",       bm_sat32_guard,        &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addsat/int/uladdsat-loop",    bm_sat32_scalar,       &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addsat/int/uladdsat_n",       bm_sat32_n,            &d, 2.0 * NELEM * sizeof(int));
+    ulbench_run("addsat/short/uladdsat-loop",  bm_sat16_scalar,       &d, 2.0 * NELEM * sizeof(short));
+    ulbench_run("addsat/short/uladdsat_n",     bm_sat16_n,            &d, 2.0 * NELEM * sizeof(short));
+
+    (free)(d.s16a); (free)(d.s16b); (free)(d.s16d);
+    (free)(d.i32a); (free)(d.i32b); (free)(d.i32d);
+}
@@ -0,0 +1,184 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Deduplicating a stream of hot, repeated keys (header and field names):
+// ulintern and ulinternshared against a ulstrdup() per occurrence, and
+// comparing the results by pointer against strcmp().
+
+#include <pthread.h>
+#if defined( __GLIBC__ )
+  #include <malloc.h>
+#endif
+#include "ulbench.h"
+#include "ulintern.h"
+
+#define NKEYS    256                   // Distinct keys
+#define NREFS    4096                  // Occurrences per operation
+#define NTHREADS 4
+
+typedef struct interndata {
+    char            *keys[NKEYS];
+    const char      *refs[NREFS];      // NREFS keys, skewed toward a few
+    const char      *canon[NREFS];     // The same, interned
+    char            *dups[NREFS];      // The same, strdup()ed
+    ulintern        *tab;
+    ulinternshared  *shared;
+} interndata;
+
+
+static void bm_strdup(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        char *p[NREFS];
+        for (int i = 0; i < NREFS; i++) { p[i] = ulstrdup(d->refs[i]); ulBENCH_KEEP(p[i]); }
+        for (int i = 0; i < NREFS; i++) (free)(p[i]);
+    }
+}
+
+static void bm_intern(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (int i = 0; i < NREFS; i++) ulBENCH_KEEP(ulintern_str(d->tab, d->refs[i]));
+    }
+}
+
+// Including building and destroying the table each time
+static void bm_intern_cold(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulintern *t = ulintern_create(0);
+        for (int i = 0; i < NREFS; i++) ulBENCH_KEEP(ulintern_str(t, d->refs[i]));
+        ulintern_destroy(t);
+    }
+}
+
+static void bm_intern_shared(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (int i = 0; i < NREFS; i++) ulBENCH_KEEP(ulinternshared_str(d->shared, d->refs[i]));
+    }
+}
+
+
+typedef struct internjob {
+    interndata *d;
+    size_t      iters;
+    ulbenchfn   fn;
+} internjob;
+
+static void *intern_thread(void *arg) {
+    internjob *j = arg;
+    j->fn(j->d, j->iters);
+    return NULL;
+}
+
+static void run_threads(interndata *d, size_t iters, ulbenchfn fn) {
+    pthread_t t[NTHREADS];
+    internjob j[NTHREADS];
+    for (int k = 0; k < NTHREADS; k++) {
+        j[k] = (internjob){ d, iters / NTHREADS + 1, fn };
+        pthread_create(&t[k], NULL, intern_thread, &j[k]);
+    }
+    for (int k = 0; k < NTHREADS; k++) pthread_join(t[k], NULL);
+}
+
+static void bm_strdup_n(void *ctx, size_t iters)        { run_threads(ctx, iters, bm_strdup); }
+static void bm_intern_shared_n(void *ctx, size_t iters) { run_threads(ctx, iters, bm_intern_shared); }
+
+
+// How many occurrences are the most common key
+static void bm_eq_strcmp(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t n = 0;
+        for (int i = 0; i < NREFS; i++) n += !strcmp(d->dups[i], d->keys[0]);
+        ulBENCH_KEEP(n);
+    }
+}
+
+static void bm_eq_pointer(void *ctx, size_t iters) {
+    interndata *d = ctx;
+    const char *k = ulintern_str(d->tab, d->keys[0]);
+    for (size_t it = 0; it < iters; it++) {
+        size_t n = 0;
+        for (int i = 0; i < NREFS; i++) n += d->canon[i] == k;
+        ulBENCH_KEEP(n);
+    }
+}
+
+
+// Heap bytes behind a malloc() block, counting an 8-byte header
+static size_t heapsize(void *p, size_t n) {
+#if defined( __GLIBC__ )
+    (void)n;
+    return malloc_usable_size(p) + 8;
+#else
+    (void)p;
+    return (n + 8 + 15) & ~(size_t)15;
+#endif
+}
+
+
+void bench_intern(void) {
+    static const char *stems[] = {
+        "content-", "accept-", "x-request-", "cache-", "user-", "field_", "tag:", "x-forwarded-",
+    };
+    interndata d;
+    uint64_t s = 2024;
+    size_t dupbytes = 0;
+
+    for (int k = 0; k < NKEYS; k++) {
+        char buf[64];
+        snprintf(buf, sizeof buf, "%s%s-%d", stems[k % 8], k & 1 ? "type" : "length", k);
+        if ((d.keys[k] = ulstrdup(buf)) == NULL) abort();
+    }
+    // Skewed toward the first keys: k = NKEYS * u^3 for uniform u in [0, 1)
+    for (int i = 0; i < NREFS; i++) {
+        double u = (double)(ulbench_rand(&s) >> 11) / 9007199254740992.0;
+        d.refs[i] = d.keys[(size_t)(NKEYS * u * u * u)];
+    }
+
+    if ((d.tab = ulintern_create(0)) == NULL || (d.shared = ulinternshared_create(0)) == NULL) abort();
+    for (int i = 0; i < NREFS; i++) {
+        d.canon[i] = ulintern_str(d.tab, d.refs[i]);
+        d.dups[i] = ulstrdup(d.refs[i]);
+        dupbytes += heapsize(d.dups[i], strlen(d.refs[i]) + 1);
+        ulinternshared_str(d.shared, d.refs[i]);
+    }
+
+    ulbench_note("intern/footprint", "%d occurrences of %zu keys: ulstrdup %zu B, ulintern %zu B, "
+                 "ulinternshared %zu B", NREFS, ulintern_count(d.tab), dupbytes,
+                 ulintern_bytes(d.tab), ulinternshared_bytes(d.shared));
+
+    ulbench_run("intern/x4096/ulstrdup-free",            bm_strdup,          &d, 0);
+    ulbench_run("intern/x4096/ulintern_str",             bm_intern,          &d, 0);
+    ulbench_run("intern/x4096/ulintern_str-cold",        bm_intern_cold,     &d, 0);
+    ulbench_run("intern/x4096/ulinternshared_str",       bm_intern_shared,   &d, 0);
+    ulbench_run("intern/x4096/4-threads/ulstrdup-free",  bm_strdup_n,        &d, 0);
+    ulbench_run("intern/x4096/4-threads/ulinternshared", bm_intern_shared_n, &d, 0);
+    ulbench_run("intern/eq/x4096/strcmp",                bm_eq_strcmp,       &d, 0);
+    ulbench_run("intern/eq/x4096/pointer",               bm_eq_pointer,      &d, 0);
+
+    for (int i = 0; i < NREFS; i++) (free)(d.dups[i]);
+    for (int k = 0; k < NKEYS; k++) (free)(d.keys[k]);
+    ulintern_destroy(d.tab);
+    ulinternshared_destroy(d.shared);
+}
@@ -0,0 +1,145 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Reading a line-oriented file: ullinereader (mmap and buffered) against
+// ulinputline() and getline(). The file is 32 MiB by default, which stays in
+// the page cache after the first pass, so the default run measures parsing
+// cost rather than the disk. Set ULBENCH_IOSIZE (bytes, or with a K, M, or
+// G suffix, e.g. ULBENCH_IOSIZE=8G) to use a multi-gigabyte file instead;
+// one larger than free memory is read from disk on every pass, and each
+// case makes at least seven passes.
+
+#include "ulbench.h"
+
+#define FILESZ   (32 << 20)            // Default size, and the text chunk
+
+// ULBENCH_IOSIZE, or FILESZ if unset or unparsable
+static size_t io_size(void) {
+    const char *s = getenv("ULBENCH_IOSIZE");
+    char *end;
+    unsigned long long n;
+
+    if (!s || !*s) return FILESZ;
+    n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10; end++; break;
+        default: break;
+    }
+    return n && !*end ? (size_t)n : FILESZ;
+}
+
+typedef struct iodata {
+    char     path[64];
+    size_t   size;
+} iodata;
+
+
+static void bm_linereader_mmap(void *ctx, size_t iters) {
+    iodata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ullinereader *r = ullinereader_open(d->path);
+        const char *line;
+        size_t len, total = 0;
+        if (!r) abort();
+        while (ullinereader_next(r, &line, &len) > 0) total += len;
+        ullinereader_close(r);
+        ulBENCH_KEEP(total);
+    }
+}
+
+static void bm_linereader_file(void *ctx, size_t iters) {
+    iodata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        FILE *fp = fopen(d->path, "r");
+        ullinereader *r = ullinereader_file(fp);
+        const char *line;
+        size_t len, total = 0;
+        if (!r) abort();
+        while (ullinereader_next(r, &line, &len) > 0) total += len;
+        ullinereader_close(r);
+        fclose(fp);
+        ulBENCH_KEEP(total);
+    }
+}
+
+static void bm_inputline(void *ctx, size_t iters) {
+    iodata *d = ctx;
+    static char buf[4096];
+    for (size_t it = 0; it < iters; it++) {
+        FILE *fp = fopen(d->path, "r");
+        size_t total = 0;
+        if (!fp) abort();
+        while (ulinputline(buf, sizeof buf, fp)) total += strlen(buf);
+        fclose(fp);
+        ulBENCH_KEEP(total);
+    }
+}
+
+static void bm_getline(void *ctx, size_t iters) {
+    iodata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        FILE *fp = fopen(d->path, "r");
+        char *line = NULL;
+        size_t cap = 0, total = 0;
+        ssize_t n;
+        if (!fp) abort();
+        while ((n = getline(&line, &cap, fp)) > 0) total += (size_t)n;
+        (free)(line);
+        fclose(fp);
+        ulBENCH_KEEP(total);
+    }
+}
+
+
+void bench_io(void) {
+    iodata d;
+    char *text;
+    int fd;
+
+    if (!ulbench_wanted("lines/ullinereader-mmap") && !ulbench_wanted("lines/ullinereader-file") &&
+        !ulbench_wanted("lines/ulinputline") && !ulbench_wanted("lines/getline")) return;
+    d.size = io_size();
+    if ((text = ulbench_text(FILESZ)) == NULL) return;
+
+    // Larger files repeat the same text
+    snprintf(d.path, sizeof d.path, "/tmp/ulbench-lines-XXXXXX");
+    if ((fd = mkstemp(d.path)) < 0) { perror("mkstemp"); (free)(text); return; }
+    for (size_t done = 0; done < d.size; ) {
+        size_t n = d.size - done < FILESZ ? d.size - done : FILESZ;
+        ssize_t w = write(fd, text, n);
+        if (w <= 0) { perror("write"); close(fd); unlink(d.path); (free)(text); return; }
+        done += (size_t)w;
+    }
+    close(fd);
+    (free)(text);
+    if (d.size != FILESZ) {
+        ulbench_note("lines/file", "%zu bytes (ULBENCH_IOSIZE)", d.size);
+    }
+
+    ulbench_run("lines/ullinereader-mmap", bm_linereader_mmap, &d, (double)d.size);
+    ulbench_run("lines/ullinereader-file", bm_linereader_file, &d, (double)d.size);
+    ulbench_run("lines/ulinputline",       bm_inputline,       &d, (double)d.size);
+    ulbench_run("lines/getline",           bm_getline,         &d, (double)d.size);
+
+    unlink(d.path);
+}
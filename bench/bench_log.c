@@ -0,0 +1,182 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// ulLOG from one thread and from several threads at once. The logging
+// backend is chosen when utillib.h is compiled, so the Makefile builds this
+// file three times: with no option (one write() per line), with ulASYNCLOG,
+// and with ulBINLOG. Output goes to /dev/null. Async and binary samples
+// include the time to flush what they logged, so they measure sustained
+// throughput. The synchronous build also runs the same cases through the
+// original ulLOG, three fprintf() calls per line, as the baseline, and times
+// ulVARDBUG against the fprintf() calls it used to expand to.
+//
+// Each throughput case is followed by a latency run that times every call
+// on its own and reports percentiles of single calls. These exclude the
+// final flush, so for the async and binary backends they show what the
+// calling thread waits for.
+
+#include <pthread.h>
+#include "ulbench.h"
+
+#if defined( ulBINLOG )
+  #define MODE       "binlog"
+  #define SUITE      bench_log_bin
+  #define FLUSH()    ul__blog_flushall()
+#elif defined( ulASYNCLOG )
+  #define MODE       "async"
+  #define SUITE      bench_log_async
+  #define FLUSH()    ul__alog_flush()
+#else
+  #define MODE       "sync"
+  #define SUITE      bench_log_sync
+  #define FLUSH()    fflush(stderr)
+#endif
+
+#define NTHREADS 4
+#define LATCALLS 20000                 // Timed calls per thread
+
+// ulLOG as it was before the single-write() backend
+#define LEGACYLOG(...) (\
+    fprintf(stderr, "In %s:%s() line %d: ", __FILE__, __func__, __LINE__)  &&\
+    fprintf(stderr, __VA_ARGS__)                                           &&\
+    fprintf(stderr, "\n")\
+    )
+
+#define LOGLINE(log, i, id) \
+    (void)log("request %zu from worker %d took %d us", i, id, (int)((i) & 1023))
+
+typedef struct logjob {
+    size_t    iters;
+    int       id;
+    int       legacy;                  // Use LEGACYLOG instead of ulLOG
+    uint64_t *lat;                     // If set, ticks per call go here
+} logjob;
+
+
+static void *log_thread(void *arg) {
+    logjob *j = arg;
+    for (size_t i = 0; i < j->iters; i++) {
+        uint64_t t0 = j->lat ? ulbench_ticks() : 0;
+        if (j->legacy) LOGLINE(LEGACYLOG, i, j->id);
+        else           LOGLINE(ulLOG, i, j->id);
+        if (j->lat) j->lat[i] = ulbench_ticks() - t0;
+    }
+    return NULL;
+}
+
+// Runs nthreads loggers sharing iters calls, then flushes; lat, if given,
+// receives the time of each call, thread by thread
+static void log_run(int nthreads, int legacy, size_t iters, uint64_t *lat) {
+    pthread_t t[NTHREADS];
+    logjob j[NTHREADS];
+    for (int k = 0; k < nthreads; k++) {
+        j[k] = (logjob){ iters / (size_t)nthreads, k, legacy,
+                         lat ? lat + (size_t)k * (iters / (size_t)nthreads) : NULL };
+        if (nthreads == 1) log_thread(&j[k]);
+        else pthread_create(&t[k], NULL, log_thread, &j[k]);
+    }
+    for (int k = 0; k < nthreads && nthreads > 1; k++) pthread_join(t[k], NULL);
+    FLUSH();
+}
+
+static void bm_log_1(void *ctx, size_t iters) {
+    (void)ctx;
+    log_run(1, 0, iters, NULL);
+}
+
+static void bm_log_n(void *ctx, size_t iters) {
+    (void)ctx;
+    log_run(NTHREADS, 0, iters + NTHREADS - 1, NULL);
+}
+
+// Throughput case, then the latency of single calls
+static void log_case(const char *mode, int nthreads, int legacy, ulbenchfn fn) {
+    static uint64_t lat[NTHREADS * LATCALLS];
+    char name[96];
+
+    if (nthreads == 1) snprintf(name, sizeof name, "log/%s/1-thread", mode);
+    else               snprintf(name, sizeof name, "log/%s/%d-threads", mode, nthreads);
+    ulbench_run(name, fn, NULL, 0);
+
+    strcat(name, "/latency");
+    if (!ulbench_wanted(name)) return;
+    log_run(nthreads, legacy, (size_t)nthreads * LATCALLS, lat);
+    ulbench_latency(name, lat, (size_t)nthreads * LATCALLS);
+}
+
+
+#if !defined( ulBINLOG ) && !defined( ulASYNCLOG )
+static void bm_legacy_1(void *ctx, size_t iters) {
+    (void)ctx;
+    log_run(1, 1, iters, NULL);
+}
+
+static void bm_legacy_n(void *ctx, size_t iters) {
+    (void)ctx;
+    log_run(NTHREADS, 1, iters + NTHREADS - 1, NULL);
+}
+
+static void bm_vardbug_fprintf(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t i = 0; i < iters; i++) {
+        int n = (int)(i & 1023);
+        double t = (double)i * 0.25;
+        fprintf(stderr, "%s:%d %s=%d\n", __FILE__, __LINE__, "n", n);
+        fprintf(stderr, "%s:%d %s=%f\n", __FILE__, __LINE__, "t", t);
+    }
+}
+
+static void bm_vardbug(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t i = 0; i < iters; i++) {
+        int n = (int)(i & 1023);
+        double t = (double)i * 0.25;
+        ulVARDBUG(n);
+        ulVARDBUG(t);
+    }
+}
+#endif
+
+
+void SUITE(void) {
+    int saved = dup(STDERR_FILENO), null = open("/dev/null", O_WRONLY);
+
+    if (saved < 0 || null < 0) return;
+#if defined( ulBINLOG )
+    setenv("ULBINLOG", "/dev/null", 1);
+#endif
+    fflush(stderr);
+    dup2(null, STDERR_FILENO);
+
+    log_case(MODE, 1, 0, bm_log_1);
+    log_case(MODE, NTHREADS, 0, bm_log_n);
+#if !defined( ulBINLOG ) && !defined( ulASYNCLOG )
+    log_case("legacy-fprintf", 1, 1, bm_legacy_1);
+    log_case("legacy-fprintf", NTHREADS, 1, bm_legacy_n);
+    ulbench_run("log/vardbug/fprintf",  bm_vardbug_fprintf, NULL, 0);
+    ulbench_run("log/vardbug/ulVARDBUG", bm_vardbug,        NULL, 0);
+#endif
+
+    FLUSH();
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(null);
+}
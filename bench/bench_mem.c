@@ -0,0 +1,103 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Secure zeroing and arena allocation
+
+#include "ulbench.h"
+
+#define MAXZERO  (64 << 20)
+
+typedef struct memdata {
+    unsigned char *buf;
+    size_t         n;
+    ularena       *arena;
+} memdata;
+
+
+// The byte-at-a-time loop ulmemzerosecure() used to be
+static void legacy_memzerosecure(void *const p, const size_t z) {
+    volatile unsigned char *volatile q = p;
+    size_t i = z;
+    while (i--) *q++ = 0;
+}
+
+static void bm_zero_secure(void *ctx, size_t iters) {
+    memdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulmemzerosecure(d->buf, d->n);
+}
+
+static void bm_zero_legacy(void *ctx, size_t iters) {
+    memdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) legacy_memzerosecure(d->buf, d->n);
+}
+
+static void bm_zero_memset(void *ctx, size_t iters) {
+    memdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        memset(d->buf, 0, d->n);
+        ulBENCH_CLOBBER();
+    }
+}
+
+
+// 64 small allocations of mixed sizes, then release them all
+static void bm_alloc_arena(void *ctx, size_t iters) {
+    memdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (size_t k = 0; k < 64; k++) ulBENCH_KEEP(ularena_alloc(d->arena, 16 + (k & 7) * 24));
+        ularena_reset(d->arena);
+    }
+}
+
+static void bm_alloc_malloc(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t it = 0; it < iters; it++) {
+        void *p[64];
+        for (size_t k = 0; k < 64; k++) { p[k] = malloc(16 + (k & 7) * 24); ulBENCH_KEEP(p[k]); }
+        for (size_t k = 0; k < 64; k++) (free)(p[k]);
+    }
+}
+
+
+void bench_mem(void) {
+    static const size_t sizes[] = { 16, 64, 256, 4096, 65536, 1 << 20, 16 << 20, MAXZERO };
+    memdata d;
+    char name[96];
+
+    if ((d.buf = malloc(MAXZERO)) == NULL || (d.arena = ularena_create(0)) == NULL) abort();
+    memset(d.buf, 1, MAXZERO);
+
+    for (size_t k = 0; k < sizeof sizes / sizeof *sizes; k++) {
+        d.n = sizes[k];
+        #define RUN(what, fn) \
+            (snprintf(name, sizeof name, "memzero/%zu/%s", d.n, what), ulbench_run(name, fn, &d, (double)d.n))
+        RUN("ulmemzerosecure",  bm_zero_secure);
+        RUN("byte-loop",        bm_zero_legacy);
+        RUN("memset",           bm_zero_memset);
+        #undef RUN
+    }
+
+    ulbench_run("alloc/x64/ularena",     bm_alloc_arena,  &d, 0);
+    ulbench_run("alloc/x64/malloc-free", bm_alloc_malloc, &d, 0);
+
+    ularena_destroy(d.arena);
+    (free)(d.buf);
+}
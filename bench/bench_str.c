@@ -0,0 +1,252 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// String search, byte sets, slices, and ulautostr
+
+#define _GNU_SOURCE
+
+#include "ulbench.h"
+#include "ulslice.h"
+
+#define HAYSZ    (1 << 20)
+
+typedef struct strdata {
+    char        *hay;
+    char        *early;                // hay with the needle 64 bytes in
+    size_t       nhay;
+    const char  *needle;
+    size_t       nneedle;
+    ulstrsearch  ss;
+    ulbyteset    delims;
+} strdata;
+
+
+static void bm_strstr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(strstr(d->hay, d->needle));
+}
+
+static void bm_strstrfirstptr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulstrstrfirstptr(d->hay, d->needle));
+}
+
+static void bm_memstrfirstptr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++)
+        ulBENCH_KEEP(ulmemstrfirstptr(d->hay, d->nhay, d->needle, d->nneedle));
+}
+
+static void bm_strsearch_first(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulstrsearch_first(&d->ss, d->hay, d->nhay));
+}
+
+#ifdef _GNU_SOURCE
+static void bm_memmem(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++)
+        ulBENCH_KEEP(memmem(d->hay, d->nhay, d->needle, d->nneedle));
+}
+#endif
+
+
+// A match near the start of a long string
+static void bm_early_strstr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(strstr(d->early, d->needle));
+}
+
+static void bm_early_strstrfirstptr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulstrstrfirstptr(d->early, d->needle));
+}
+
+
+// What callers wrote in the absence of strrstr()
+static const char *naive_strrstr(const char *h, size_t hn, const char *n, size_t nn) {
+    if (nn > hn) return NULL;
+    for (size_t i = hn - nn + 1; i-- > 0; ) {
+        if (h[i] == n[0] && !memcmp(h + i, n, nn)) return h + i;
+    }
+    return NULL;
+}
+
+static void bm_naive_last(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++)
+        ulBENCH_KEEP(naive_strrstr(d->hay, d->nhay, d->needle, d->nneedle));
+}
+
+static void bm_strstrlastptr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulstrstrlastptr(d->hay, d->needle));
+}
+
+static void bm_strsearch_last(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulstrsearch_last(&d->ss, d->hay, d->nhay));
+}
+
+
+// Tokenizing the whole haystack on " ,.\n"
+static void bm_tok_strcspn(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t ntok = 0;
+        for (const char *p = d->hay; *p; ) {
+            size_t n = strcspn(p, " ,.\n");
+            ntok++;
+            p += n + (p[n] != '\0');
+        }
+        ulBENCH_KEEP(ntok);
+    }
+}
+
+static void bm_tok_cspan(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t ntok = 0;
+        for (const char *p = d->hay; *p; ) {
+            size_t n = ulbyteset_cspan(&d->delims, p);
+            ntok++;
+            p += n + (p[n] != '\0');
+        }
+        ulBENCH_KEEP(ntok);
+    }
+}
+
+static void bm_tok_bytesplit(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulbytesplit sp;
+        const char *f;
+        size_t len, ntok = 0;
+        ulbytesplit_init(&sp, &d->delims, d->hay, d->nhay);
+        while (ulbytesplit_next(&sp, &f, &len)) ntok++;
+        ulBENCH_KEEP(ntok);
+    }
+}
+
+static void bm_lines_strchr(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t n = 0;
+        for (const char *p = d->hay; (p = strchr(p, '\n')) != NULL; p++) n++;
+        ulBENCH_KEEP(n);
+    }
+}
+
+static void bm_lines_slice(void *ctx, size_t iters) {
+    strdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulslice rest = ulslice_make(d->hay, d->nhay), line;
+        size_t n = 0;
+        while (ulslice_split(&rest, '\n', &line)) n++;
+        ulBENCH_KEEP(n);
+    }
+}
+
+
+// Sixteen short temporary strings per iteration, as in one log statement
+static void bm_autostr_ring(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (int k = 0; k < 16; k++) ulBENCH_KEEP(ulautostr(ulstrdup("temporary string value")));
+    }
+}
+
+static void bm_autostr_scope(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ularenamark m = ultmp_begin();
+        for (int k = 0; k < 16; k++) ulBENCH_KEEP(ulautostr(ulstrdup("temporary string value")));
+        ultmp_end(m);
+    }
+}
+
+static void bm_strdup_free(void *ctx, size_t iters) {
+    (void)ctx;
+    for (size_t it = 0; it < iters; it++) {
+        char *s[16];
+        for (int k = 0; k < 16; k++) { s[k] = ulstrdup("temporary string value"); ulBENCH_KEEP(s[k]); }
+        for (int k = 0; k < 16; k++) (free)(s[k]);
+    }
+}
+
+
+void bench_str(void) {
+    static const struct { const char *label, *needle; } needles[] = {
+        { "short", "qzx" },
+        { "medium", "buffer pointer latency zq" },
+        { "long", "benchmark throughput of the utility function for this header qz" },
+    };
+    strdata d;
+    char name[96];
+    double b;
+
+    d.hay   = ulbench_text(HAYSZ);
+    d.nhay  = HAYSZ;
+    d.early = ulbench_text(HAYSZ);
+    b      = (double)d.nhay;
+    ulbyteset_init(&d.delims, " ,.\n");
+
+    // Absent needles, so every search scans the whole haystack
+    for (size_t k = 0; k < sizeof needles / sizeof *needles; k++) {
+        d.needle  = needles[k].needle;
+        d.nneedle = strlen(d.needle);
+        ulstrsearch_init(&d.ss, d.needle, d.nneedle);
+
+        #define RUN(what, fn) \
+            (snprintf(name, sizeof name, "search/%s/%s", needles[k].label, what), ulbench_run(name, fn, &d, b))
+        RUN("strstr",               bm_strstr);
+        RUN("ulstrstrfirstptr",     bm_strstrfirstptr);
+        RUN("ulmemstrfirstptr",     bm_memstrfirstptr);
+        RUN("ulstrsearch_first",    bm_strsearch_first);
+#ifdef _GNU_SOURCE
+        RUN("memmem",               bm_memmem);
+#endif
+        RUN("naive-strrstr",        bm_naive_last);
+        RUN("ulstrstrlastptr",      bm_strstrlastptr);
+        RUN("ulstrsearch_last",     bm_strsearch_last);
+        #undef RUN
+
+        memcpy(d.early, d.hay, HAYSZ + 1);
+        memcpy(d.early + 64, d.needle, d.nneedle);
+        snprintf(name, sizeof name, "search/%s/early/strstr", needles[k].label);
+        ulbench_run(name, bm_early_strstr, &d, 0);
+        snprintf(name, sizeof name, "search/%s/early/ulstrstrfirstptr", needles[k].label);
+        ulbench_run(name, bm_early_strstrfirstptr, &d, 0);
+    }
+
+    ulbench_run("bytes/tokenize/strcspn",          bm_tok_strcspn,   &d, b);
+    ulbench_run("bytes/tokenize/ulbyteset_cspan",  bm_tok_cspan,     &d, b);
+    ulbench_run("bytes/tokenize/ulbytesplit",      bm_tok_bytesplit, &d, b);
+    ulbench_run("bytes/lines/strchr",              bm_lines_strchr,  &d, b);
+    ulbench_run("bytes/lines/ulslice_split",       bm_lines_slice,   &d, b);
+
+    ulbench_run("autostr/x16/ring",                bm_autostr_ring,  NULL, 0);
+    ulbench_run("autostr/x16/tmp-scope",           bm_autostr_scope, NULL, 0);
+    ulbench_run("autostr/x16/strdup-free",         bm_strdup_free,   NULL, 0);
+
+    (free)(d.hay);
+    (free)(d.early);
+}
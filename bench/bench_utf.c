@@ -0,0 +1,299 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// UTF-8 and UTF-16 conversion: the bulk and streaming APIs against loops
+// over the per-character functions they replace. UTF-8 validation, code
+// point counting, and random access by code point index.
+
+#include "ulbench.h"
+
+#define TEXTSZ   (1 << 22)
+#define CHUNKSZ  (1 << 16)
+#define NLOOKUP  64
+
+typedef struct utfdata {
+    unsigned char *u8;                 // TEXTSZ bytes of UTF-8, plus padding
+    size_t         n8;
+    int32_t       *cp;                 // Its code points
+    size_t         ncp;
+    uint16_t      *u16;                // Its UTF-16
+    size_t         n16;
+    int32_t       *cpout;              // Scratch outputs
+    unsigned char *u8out;
+    uint16_t      *u16out;
+    size_t         k[NLOOKUP];         // Code point indices to look up
+    ulutf8index   *ix;
+} utfdata;
+
+
+// Mostly ASCII (ascii = 1), or mixed Latin/Greek/CJK/emoji text
+static void make_text(utfdata *d, int ascii) {
+    const char *text = ulbench_text(TEXTSZ);
+    uint64_t s = 12345;
+    size_t i = 0;
+
+    d->n8 = d->ncp = 0;
+    while (d->n8 + 4 <= TEXTSZ) {
+        int32_t c = (unsigned char)text[i++ % TEXTSZ];
+        if (!ascii && c == ' ') {
+            switch (ulbench_rand(&s) % 8) {
+                case 0: c = 0x00E9; break;                   // e-acute
+                case 1: c = 0x03BB; break;                   // lambda
+                case 2: c = 0x4E2D; break;                   // CJK
+                case 3: c = 0x20AC; break;                   // Euro sign
+                case 4: c = 0x1F600; break;                  // Emoji
+                default: break;
+            }
+        }
+        d->cp[d->ncp++] = c;
+        d->n8 += ulutf8_from_cdpt_r(c, d->u8 + d->n8, 4);
+    }
+    memset(d->u8 + d->n8, 0, 8);
+
+    d->n16 = 0;
+    for (size_t k = 0; k < d->ncp; k++) {
+        uint16_t hi, lo;
+        ulutf16_from_cdpt(d->cp[k], &hi, &lo);
+        if (hi) d->u16[d->n16++] = hi;
+        d->u16[d->n16++] = lo;
+    }
+    (free)((void *)text);
+}
+
+
+static void bm_decode_bulk(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulutfresult r = ulcdpts_from_utf8(d->u8, d->n8, d->cpout, d->ncp);
+        ulBENCH_KEEP(r.nwritten);
+    }
+}
+
+static void bm_decode_percall(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t i = 0, o = 0;
+        while (i < d->n8) {
+            int32_t c = ulcdpt_from_utf8(d->u8 + i);
+            d->cpout[o++] = c;
+            i += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+
+static void bm_encode_bulk(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulutfresult r = ulutf8_from_cdpts(d->cp, d->ncp, d->u8out, TEXTSZ);
+        ulBENCH_KEEP(r.nwritten);
+    }
+}
+
+static void bm_encode_r(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t o = 0;
+        for (size_t k = 0; k < d->ncp; k++) o += ulutf8_from_cdpt_r(d->cp[k], d->u8out + o, 4);
+        ulBENCH_KEEP(o);
+    }
+}
+
+static void bm_encode_percall(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t o = 0;
+        for (size_t k = 0; k < d->ncp; k++) {
+            const unsigned char *u = ulutf8_from_cdpt(d->cp[k]);
+            size_t l = strlen((const char *)u);
+            memcpy(d->u8out + o, u, l);
+            o += l;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+
+static void bm_to16_stream(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulutfstream st = { 0 };
+        size_t o = 0;
+        for (size_t i = 0; i < d->n8; i += CHUNKSZ) {
+            size_t n = d->n8 - i < CHUNKSZ ? d->n8 - i : CHUNKSZ;
+            o += ulutf16_from_utf8_chunk(&st, d->u8 + i, n, d->u16out + o, TEXTSZ - o).nwritten;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+static void bm_to16_percall(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t i = 0, o = 0;
+        while (i < d->n8) {
+            int32_t c = ulcdpt_from_utf8(d->u8 + i);
+            uint16_t hi, lo;
+            ulutf16_from_cdpt(c, &hi, &lo);
+            if (hi) d->u16out[o++] = hi;
+            d->u16out[o++] = lo;
+            i += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+
+static void bm_to8_stream(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulutfstream st = { 0 };
+        size_t o = 0;
+        for (size_t i = 0; i < d->n16; i += CHUNKSZ / 2) {
+            size_t n = d->n16 - i < CHUNKSZ / 2 ? d->n16 - i : CHUNKSZ / 2;
+            o += ulutf8_from_utf16_chunk(&st, d->u16 + i, n, d->u8out + o, TEXTSZ - o).nwritten;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+static void bm_to8_percall(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t o = 0;
+        for (size_t i = 0; i < d->n16; i++) {
+            uint16_t hi = 0, lo = d->u16[i];
+            if (lo >= 0xD800 && lo <= 0xDBFF && i + 1 < d->n16) { hi = lo; lo = d->u16[++i]; }
+            const unsigned char *u = ulutf8_from_cdpt(ulcdpt_from_utf16(hi, lo));
+            size_t l = strlen((const char *)u);
+            memcpy(d->u8out + o, u, l);
+            o += l;
+        }
+        ulBENCH_KEEP(o);
+    }
+}
+
+
+static void bm_validate(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulutf8_validate(d->u8, d->n8));
+}
+
+// One strict decode per sequence, which is what validation cost before
+static void bm_validate_decode1(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t i = 0;
+        int32_t c;
+        int n;
+        while (i < d->n8 && (n = ul__utf8_decode1(d->u8 + i, d->n8 - i, &c)) != 0) i += (size_t)n;
+        ulBENCH_KEEP(i);
+    }
+}
+
+static void bm_count(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) ulBENCH_KEEP(ulutf8_count(d->u8, d->n8));
+}
+
+static void bm_count_bytes(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        size_t c = 0;
+        for (size_t i = 0; i < d->n8; i++) c += (d->u8[i] & 0xC0) != 0x80;
+        ulBENCH_KEEP(c);
+    }
+}
+
+static void bm_index_create(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        ulutf8index *ix = ulutf8index_create(d->u8, d->n8, 0);
+        ulBENCH_KEEP(ix->off[0]);
+        ulutf8index_destroy(ix);
+    }
+}
+
+static void bm_index_lookup(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (int j = 0; j < NLOOKUP; j++) ulBENCH_KEEP(ulutf8index_offset(d->ix, d->k[j]));
+    }
+}
+
+static void bm_offset_scan(void *ctx, size_t iters) {
+    utfdata *d = ctx;
+    for (size_t it = 0; it < iters; it++) {
+        for (int j = 0; j < NLOOKUP; j++) ulBENCH_KEEP(ulutf8_offset(d->u8, d->n8, d->k[j]));
+    }
+}
+
+
+void bench_utf(void) {
+    static const char *kind[] = { "ascii", "mixed" };
+    utfdata d;
+    char name[96];
+
+    d.u8     = malloc(TEXTSZ + 8);
+    d.cp     = malloc(TEXTSZ * sizeof *d.cp);
+    d.u16    = malloc(TEXTSZ * sizeof *d.u16);
+    d.cpout  = malloc(TEXTSZ * sizeof *d.cpout);
+    d.u8out  = malloc(TEXTSZ);
+    d.u16out = malloc(TEXTSZ * sizeof *d.u16out);
+    if (!d.u8 || !d.cp || !d.u16 || !d.cpout || !d.u8out || !d.u16out) abort();
+
+    for (int k = 0; k < 2; k++) {
+        make_text(&d, k == 0);
+        double b = (double)d.n8;
+
+        #define RUN(what, fn) \
+            (snprintf(name, sizeof name, "utf8/%s/%s", what, kind[k]), ulbench_run(name, fn, &d, b))
+        RUN("decode/ulcdpts_from_utf8",        bm_decode_bulk);
+        RUN("decode/ulcdpt_from_utf8-loop",    bm_decode_percall);
+        RUN("encode/ulutf8_from_cdpts",        bm_encode_bulk);
+        RUN("encode/ulutf8_from_cdpt_r-loop",  bm_encode_r);
+        RUN("encode/ulutf8_from_cdpt-loop",    bm_encode_percall);
+        RUN("to16/ulutf16_from_utf8_chunk",    bm_to16_stream);
+        RUN("to16/per-codepoint-loop",         bm_to16_percall);
+        RUN("from16/ulutf8_from_utf16_chunk",  bm_to8_stream);
+        RUN("from16/per-codepoint-loop",       bm_to8_percall);
+        RUN("validate/ulutf8_validate",        bm_validate);
+        RUN("validate/decode1-loop",           bm_validate_decode1);
+        RUN("count/ulutf8_count",              bm_count);
+        RUN("count/byte-loop",                 bm_count_bytes);
+        RUN("index/ulutf8index_create",        bm_index_create);
+        #undef RUN
+
+        // NLOOKUP random code point indices, with and without an index
+        uint64_t s = 7;
+        for (int j = 0; j < NLOOKUP; j++) d.k[j] = (size_t)(ulbench_rand(&s) % d.ncp);
+        if ((d.ix = ulutf8index_create(d.u8, d.n8, 0)) == NULL) abort();
+        snprintf(name, sizeof name, "utf8/index/x%d/ulutf8index_offset/%s", NLOOKUP, kind[k]);
+        ulbench_run(name, bm_index_lookup, &d, 0);
+        snprintf(name, sizeof name, "utf8/index/x%d/ulutf8_offset/%s", NLOOKUP, kind[k]);
+        ulbench_run(name, bm_offset_scan, &d, 0);
+        ulutf8index_destroy(d.ix);
+    }
+
+    (free)(d.u8); (free)(d.cp); (free)(d.u16);
+    (free)(d.cpout); (free)(d.u8out); (free)(d.u16out);
+}
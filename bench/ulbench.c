@@ -0,0 +1,332 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Run the utillib benchmark suite.
+//
+//     make -C bench run                      # Build, run all, write results.json
+//     ./ulbench [options] [filter ...]
+//
+//     --json FILE       Write results as JSON
+//     --baseline FILE   Compare medians against an earlier --json run
+//     --reps N          Samples per benchmark (default 51)
+//     --sample-ms MS    Minimum time per sample (default 2)
+//     --budget-ms MS    Time budget per benchmark (default 1000)
+//
+// A filter selects the benchmarks whose names contain it, e.g. "utf8/".
+
+#include <stdarg.h>
+#include "ulbench.h"
+
+#ifndef ulBENCHMAXRESULTS
+#define ulBENCHMAXRESULTS 1024
+#endif
+
+typedef struct result {
+    char      name[96];
+    size_t    iters, reps;
+    double    min_ns, med_ns, p99_ns, tsc, gbps;
+} result;
+
+typedef struct baseline {
+    char      name[96];
+    double    med_ns;
+} baseline;
+
+volatile uintptr_t ulbench_sink;
+
+static struct {
+    char    **filters;
+    int       nfilters;
+    size_t    reps;
+    double    sample_ns, budget_ns;
+    result    res[ulBENCHMAXRESULTS];
+    size_t    nres;
+    baseline *base;
+    size_t    nbase;
+} H;
+
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+static int bydouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+static int wanted(const char *name) {
+    if (H.nfilters == 0) return 1;
+    for (int i = 0; i < H.nfilters; i++) {
+        if (strstr(name, H.filters[i])) return 1;
+    }
+    return 0;
+}
+
+int ulbench_wanted(const char *name) {
+    return wanted(name);
+}
+
+
+static const baseline *find_baseline(const char *name) {
+    for (size_t i = 0; i < H.nbase; i++) {
+        if (!strcmp(H.base[i].name, name)) return &H.base[i];
+    }
+    return NULL;
+}
+
+
+void ulbench_run(const char *name, ulbenchfn fn, void *ctx, double bytes_per_op) {
+    static double ns[4096], tk[4096];
+    size_t iters = 1, reps = 0, maxreps = H.reps < 4096 ? H.reps : 4096;
+    double t0, t, start;
+    result *r;
+
+    if (!wanted(name) || H.nres == ulBENCHMAXRESULTS) return;
+
+    // Calibrate: grow iters until one sample meets the target time
+    for (;;) {
+        t0 = now_ns();
+        fn(ctx, iters);
+        t = now_ns() - t0;
+        if (t >= H.sample_ns || iters >= ((size_t)1 << 40)) break;
+        iters = t < H.sample_ns / 64 ? iters * 16 : iters * 2;
+    }
+
+    // Warm up for about a tenth of the budget, then sample
+    for (start = now_ns(); now_ns() - start < H.budget_ns / 10 && t < H.budget_ns / 10; ) {
+        fn(ctx, iters);
+    }
+    for (start = now_ns(); reps < maxreps; reps++) {
+        uint64_t c0;
+        if (reps >= 5 && now_ns() - start > H.budget_ns) break;
+        t0 = now_ns();
+        c0 = ulBENCHTSC();
+        fn(ctx, iters);
+        tk[reps] = (double)(ulBENCHTSC() - c0) / (double)iters;
+        ns[reps] = (now_ns() - t0) / (double)iters;
+    }
+
+    qsort(ns, reps, sizeof *ns, bydouble);
+    qsort(tk, reps, sizeof *tk, bydouble);
+
+    r = &H.res[H.nres++];
+    snprintf(r->name, sizeof r->name, "%s", name);
+    r->iters  = iters;
+    r->reps   = reps;
+    r->min_ns = ns[0];
+    r->med_ns = ns[reps / 2];
+    r->p99_ns = ns[(reps * 99 + 99) / 100 - 1];
+    r->tsc    = tk[reps / 2];
+    r->gbps   = bytes_per_op > 0 ? bytes_per_op / r->med_ns : 0;
+
+    printf("%-44s %11.1f %11.1f %11.1f %9.0f", r->name, r->med_ns, r->min_ns, r->p99_ns, r->tsc);
+    if (r->gbps > 0) printf(" %8.2f", r->gbps);
+    else             printf(" %8s", "");
+    const baseline *b = find_baseline(name);
+    if (b && b->med_ns > 0) printf(" %+7.1f%%", (r->med_ns - b->med_ns) / b->med_ns * 100);
+    putchar('\n');
+    fflush(stdout);
+}
+
+
+void ulbench_note(const char *name, const char *fmt, ...) {
+    va_list ap;
+    if (!wanted(name)) return;
+    printf("%-44s ", name);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+    fflush(stdout);
+}
+
+
+static int byu64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Ticks of ulbench_ticks() per ns, measured once over about 20 ms
+static double ticks_per_ns(void) {
+    static double r;
+    if (r == 0) {
+        double t0 = now_ns();
+        uint64_t c0 = ulbench_ticks();
+        while (now_ns() - t0 < 20e6) {}
+        r = (double)(ulbench_ticks() - c0) / (now_ns() - t0);
+    }
+    return r;
+}
+
+void ulbench_latency(const char *name, uint64_t *ticks, size_t n) {
+    double k;
+    if (!wanted(name) || n == 0) return;
+    k = ticks_per_ns();
+    qsort(ticks, n, sizeof *ticks, byu64);
+    ulbench_note(name, "per-op ns over %zu ops: p50 %.0f  p99 %.0f  p999 %.0f  max %.0f", n,
+                 (double)ticks[n / 2] / k, (double)ticks[(n * 99 + 99) / 100 - 1] / k,
+                 (double)ticks[(n * 999 + 999) / 1000 - 1] / k, (double)ticks[n - 1] / k);
+}
+
+
+// The JSON written below has one result per line, so it can be read back
+// line by line without a JSON parser.
+static int load_baseline(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char line[512];
+    size_t cap = 0;
+
+    if (!fp) return -1;
+    while (fgets(line, sizeof line, fp)) {
+        const char *n = strstr(line, "\"name\": \""), *m = strstr(line, "\"median_ns\": ");
+        baseline b;
+        size_t len;
+        if (!n || !m) continue;
+        n += 9;
+        len = strcspn(n, "\"");
+        if (len >= sizeof b.name) continue;
+        memcpy(b.name, n, len);
+        b.name[len] = '\0';
+        b.med_ns = strtod(m + 13, NULL);
+        if (H.nbase == cap) {
+            baseline *nb = realloc(H.base, (cap = cap ? cap * 2 : 64) * sizeof *nb);
+            if (!nb) break;
+            H.base = nb;
+        }
+        H.base[H.nbase++] = b;
+    }
+    fclose(fp);
+    return 0;
+}
+
+
+static int write_json(const char *path) {
+    FILE *fp = fopen(path, "w");
+    time_t now = time(NULL);
+    char when[32];
+
+    if (!fp) return -1;
+    strftime(when, sizeof when, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(fp, "{\n  \"date\": \"%s\",\n", when);
+#if defined( __VERSION__ )
+    fprintf(fp, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+#if defined( ulHAVEAVX2 )
+    fprintf(fp, "  \"simd\": \"avx2\",\n");
+#elif defined( ulHAVESSE2 )
+    fprintf(fp, "  \"simd\": \"sse2\",\n");
+#else
+    fprintf(fp, "  \"simd\": \"none\",\n");
+#endif
+    fprintf(fp, "  \"results\": [\n");
+    for (size_t i = 0; i < H.nres; i++) {
+        const result *r = &H.res[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"iters\": %zu, \"reps\": %zu, \"min_ns\": %.3f, "
+                    "\"median_ns\": %.3f, \"p99_ns\": %.3f, \"tsc_median\": %.1f, \"gbps\": %.3f}%s\n",
+                r->name, r->iters, r->reps, r->min_ns, r->med_ns, r->p99_ns, r->tsc, r->gbps,
+                i + 1 < H.nres ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    return fclose(fp);
+}
+
+
+char *ulbench_text(size_t n) {
+    static const char *words[] = {
+        "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with",
+        "was", "on", "be", "by", "this", "are", "from", "at", "or", "an", "which",
+        "buffer", "string", "pointer", "allocation", "thread", "latency", "header",
+        "function", "character", "sequence", "benchmark", "throughput", "utility",
+    };
+    uint64_t s = 0x9E3779B97F4A7C15ULL;
+    size_t i = 0, col = 0;
+    char *text = malloc(n + 1);
+
+    if (!text) abort();
+    while (i < n) {
+        const char *w = words[ulbench_rand(&s) % (sizeof words / sizeof *words)];
+        size_t wl = strlen(w);
+        uint64_t r = ulbench_rand(&s) % 16;
+        if (i + wl + 1 > n) break;
+        memcpy(text + i, w, wl);
+        i += wl;
+        col += wl + 1;
+        text[i++] = col > 72 ? (col = 0, '\n') : r == 0 ? ',' : r == 1 ? '.' : ' ';
+    }
+    memset(text + i, ' ', n - i);
+    text[n] = '\0';
+    return text;
+}
+
+
+int main(int argc, char **argv) {
+    const char *json = NULL;
+
+    if ((H.filters = calloc((size_t)argc, sizeof *H.filters)) == NULL) return EXIT_FAILURE;
+    H.reps      = 51;
+    H.sample_ns = 2e6;
+    H.budget_ns = 1e9;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "--json")      && i + 1 < argc) json = argv[++i];
+        else if (!strcmp(argv[i], "--reps")      && i + 1 < argc) H.reps = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--sample-ms") && i + 1 < argc) H.sample_ns = atof(argv[++i]) * 1e6;
+        else if (!strcmp(argv[i], "--budget-ms") && i + 1 < argc) H.budget_ns = atof(argv[++i]) * 1e6;
+        else if (!strcmp(argv[i], "--baseline")  && i + 1 < argc) {
+            if (load_baseline(argv[++i]) < 0) {
+                fprintf(stderr, "%s: cannot read baseline %s\n", argv[0], argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--json FILE] [--baseline FILE] [--reps N] "
+                            "[--sample-ms MS] [--budget-ms MS] [filter ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        else H.filters[H.nfilters++] = argv[i];
+    }
+    if (H.reps < 5) H.reps = 5;
+
+    printf("%-44s %11s %11s %11s %9s %8s%s\n", "benchmark", "median ns", "min ns",
+           "p99 ns", "tsc", "GB/s", H.nbase ? "  vs base" : "");
+
+    bench_utf();
+    bench_str();
+    bench_mem();
+    bench_arith();
+    bench_io();
+    bench_log_sync();
+    bench_log_async();
+    bench_log_bin();
+    bench_intern();
+
+    if (json && write_json(json) != 0) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], json);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
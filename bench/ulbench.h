@@ -0,0 +1,111 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+#ifndef ULBENCH_H__
+#define ULBENCH_H__
+
+// Microbenchmark harness
+// ----------------------
+// A benchmark is a function that performs its operation iters times:
+//
+//     static void bm_thing(void *ctx, size_t iters) {
+//         for (size_t i = 0; i < iters; i++) ulBENCH_KEEP(thing(ctx));
+//     }
+//     ulbench_run("group/thing", bm_thing, ctx, bytes_per_op);
+//
+// ulbench_run() first picks iters so that one sample takes at least the
+// target sample time, then runs warmup samples, then records up to --reps
+// samples (fewer, but at least 5, if the time budget runs out). It reports
+// min/median/p99 time per operation, TSC ticks per operation where the
+// CPU has a TSC, and GB/s when bytes_per_op is nonzero. Benchmarks whose
+// names contain none of the command-line filters are skipped.
+//
+// Each suite (bench_*.c) exports one function that calls ulbench_run() for
+// every case; ulbench.c holds the harness and the list of suites.
+
+#define ulCROWDEDNAMESPACE
+#include "utillib.h"
+
+typedef void (*ulbenchfn)(void *ctx, size_t iters);
+
+void ulbench_run(const char *name, ulbenchfn fn, void *ctx, double bytes_per_op);
+
+// Print a line of other measurements (sizes, counts) under a benchmark name,
+// subject to the same filters
+void ulbench_note(const char *name, const char *fmt, ...);
+
+// Whether a benchmark name passes the command-line filters
+int ulbench_wanted(const char *name);
+
+// Per-operation latency: time each operation with ulbench_ticks(), then pass
+// the n deltas to ulbench_latency(), which sorts them and prints p50, p99,
+// p999, and max in ns under name. Ticks are TSC cycles where the CPU has a
+// TSC, else CLOCK_MONOTONIC ns.
+#if defined( __x86_64__ ) || defined( __i386__ )
+  #include <x86intrin.h>
+  #define ulBENCHTSC() __rdtsc()
+  static inline uint64_t ulbench_ticks(void) { return __rdtsc(); }
+#else
+  #define ulBENCHTSC() 0ULL
+  static inline uint64_t ulbench_ticks(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+  }
+#endif
+
+void ulbench_latency(const char *name, uint64_t *ticks, size_t n);
+
+// Keep a value, or everything in memory, from being optimized away
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define ulBENCH_KEEP(x)   do { __typeof__(x) ul__k = (x);                      \
+                               __asm__ __volatile__("" : : "g"(ul__k) : "memory"); } while (0)
+#define ulBENCH_CLOBBER() __asm__ __volatile__("" : : : "memory")
+#else
+extern volatile uintptr_t ulbench_sink;
+#define ulBENCH_KEEP(x)   (ulbench_sink += (uintptr_t)(x))
+#define ulBENCH_CLOBBER() ((void)ulbench_sink)
+#endif
+
+// Deterministic data for reproducible runs (xorshift64*)
+static inline uint64_t ulbench_rand(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+// n bytes of lowercase English-like words with punctuation and newlines,
+// NUL-terminated, in a new malloc() block
+char *ulbench_text(size_t n);
+
+// Suites
+void bench_utf(void);
+void bench_str(void);
+void bench_mem(void);
+void bench_arith(void);
+void bench_io(void);
+void bench_log_sync(void);
+void bench_log_async(void);
+void bench_log_bin(void);
+void bench_intern(void);
+
+#endif
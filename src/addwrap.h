@@ -23,10 +23,27 @@
 #define ADDWRAP_H__
 
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ulNOSIMD
+  #if defined( __SSE2__ ) || defined( _M_X64 ) || \
+     (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+    #define ulHAVESSE2
+    #include <emmintrin.h>
+  #endif
+  #if defined( __AVX2__ )
+    #define ulHAVEAVX2
+    #include <immintrin.h>
+  #endif
+#endif
 
 // #define ulCROWDEDNAMESPACE
 #ifndef ulCROWDEDNAMESPACE
   #define addwrap(...)         uladdwrap(__VA_ARGS__)
+  #define addwrap_n(...)       uladdwrap_n(__VA_ARGS__)
+  #define addwrap_reduce(...)  uladdwrap_reduce(__VA_ARGS__)
 #endif
 
 //===========================================================================
@@ -68,59 +85,257 @@
                                              int: uladdwraplong,        \
                                             long: uladdwraplong,        \
                                          default: uladdwraplonglong),   \
-                             default: ul__addwraplonglong)(a, b)
+                             default: uladdwraplonglong)(a, b)
+
+// Each function adds in the corresponding unsigned type, where overflow is
+// defined to wrap, then maps the result back to the signed range. The
+// conversion is written so it is portable C, yet compilers reduce the whole
+// function to a single add with no branches or comparisons.
+#define ul__TOSIGNED(u, T, UT, MIN, MAX) \
+    ((u) <= (UT)(MAX) ? (T)(u) : (T)((T)((u) - (UT)(MIN)) + (MIN)))
 
 static inline char uladdwrapchar(char a, char b) {
 #if SCHAR_MIN == CHAR_MIN
-    char result;
-    result = ((a<0 && b<CHAR_MIN-a) ? (CHAR_MAX+(b-(CHAR_MIN-a)+1)) :
-              (a>0 && b>CHAR_MAX-a) ? (CHAR_MIN+(b-(CHAR_MAX-a)-1)) :
-              (a + b));
-    return result;
+    unsigned char u = (unsigned char)((unsigned char)a + (unsigned char)b);
+    return ul__TOSIGNED(u, char, unsigned char, CHAR_MIN, CHAR_MAX);
 #else
     // If char is unsigned, wrapping is built into the compiler.
-    return a + b;
+    return (char)(a + b);
 #endif
 }
 
 static inline signed char uladdwrapsignedchar(signed char a, signed char b) {
-    signed char result;
-    result = ((a<0 && b<SCHAR_MIN-a) ? (SCHAR_MAX+(b-(SCHAR_MIN-a)+1)) :
-              (a>0 && b>SCHAR_MAX-a) ? (SCHAR_MIN+(b-(SCHAR_MAX-a)-1)) :
-              (a + b));
-    return result;
+    unsigned char u = (unsigned char)((unsigned char)a + (unsigned char)b);
+    return ul__TOSIGNED(u, signed char, unsigned char, SCHAR_MIN, SCHAR_MAX);
 }
 
 static inline short uladdwrapshort(short a, short b) {
-    short result;
-    result = ((a<0 && b<SHRT_MIN-a) ? (SHRT_MAX+(b-(SHRT_MIN-a)+1)) :
-             (a>0 && b>SHRT_MAX-a) ? (SHRT_MIN+(b-(SHRT_MAX-a)-1)) :
-             (a + b));
-    return result;
+    unsigned short u = (unsigned short)((unsigned short)a + (unsigned short)b);
+    return ul__TOSIGNED(u, short, unsigned short, SHRT_MIN, SHRT_MAX);
 }
 
 static inline int uladdwrapint(int a, int b) {
-    int result;
-    result = ((a<0 && b<INT_MIN-a) ? (INT_MAX+(b-(INT_MIN-a)+1)) :
-             (a>0 && b>INT_MAX-a) ? (INT_MIN+(b-(INT_MAX-a)-1)) :
-             (a + b));
-    return result;
+    unsigned u = (unsigned)a + (unsigned)b;
+    return ul__TOSIGNED(u, int, unsigned, INT_MIN, INT_MAX);
 }
 
 static inline long uladdwraplong(long a, long b) {
-    long result;
-    result = ((a<0 && b<LONG_MIN-a) ? (LONG_MAX+(b-(LONG_MIN-a)+1)) :
-              (a>0 && b>LONG_MAX-a) ? (LONG_MIN+(b-(LONG_MAX-a)-1)) :
-              (a + b));
-    return result;
+    unsigned long u = (unsigned long)a + (unsigned long)b;
+    return ul__TOSIGNED(u, long, unsigned long, LONG_MIN, LONG_MAX);
 }
 
 static inline long long uladdwraplonglong(long long a, long long b) {
-    long long result;
-    result = ((a<0 && b<LLONG_MIN-a) ? (LLONG_MAX+(b-(LLONG_MIN-a)+1)) :
-              (a>0 && b>LLONG_MAX-a) ? (LLONG_MIN+(b-(LLONG_MAX-a)-1)) :
-              (a + b));
-    return result;
+    unsigned long long u = (unsigned long long)a + (unsigned long long)b;
+    return ul__TOSIGNED(u, long long, unsigned long long, LLONG_MIN, LLONG_MAX);
+}
+
+
+
+//===========================================================================
+//                  Wraparound addition over whole arrays
+//===========================================================================
+// uladdwrap_n(dst, a, b, n) sets dst[i] = uladdwrap(a[i], b[i]) for n
+// elements. dst may be a or b (to accumulate in place) but must not
+// otherwise overlap them. uladdwrap_reduce(a, n) returns the wrapped sum of
+// n elements. Both dispatch on the element type of their first argument.
+//
+// Two's complement addition is the same operation on signed and unsigned
+// lanes, so the bulk of each array goes through 32- or 16-byte vector adds
+// (AVX2/SSE2) and only the tail is done one element at a time.
+
+#define uladdwrap_n(dst, a, b, n) _Generic((dst),                       \
+                                      char *: uladdwrapchar_n,          \
+                               signed char *: uladdwrapsignedchar_n,    \
+                                     short *: uladdwrapshort_n,         \
+                                       int *: uladdwrapint_n,           \
+                                      long *: uladdwraplong_n,          \
+                                     default: uladdwraplonglong_n)(dst, a, b, n)
+
+#define uladdwrap_reduce(a, n) _Generic((a),                            \
+                  char *: uladdwrapchar_reduce,                         \
+            const char *: uladdwrapchar_reduce,                         \
+           signed char *: uladdwrapsignedchar_reduce,                   \
+     const signed char *: uladdwrapsignedchar_reduce,                   \
+                 short *: uladdwrapshort_reduce,                        \
+           const short *: uladdwrapshort_reduce,                        \
+                   int *: uladdwrapint_reduce,                          \
+             const int *: uladdwrapint_reduce,                          \
+                  long *: uladdwraplong_reduce,                         \
+            const long *: uladdwraplong_reduce,                         \
+                 default: uladdwraplonglong_reduce)(a, n)
+
+
+// Vector part of an n-element add with w-byte lanes; returns elements done
+static inline size_t ul__addwrap_vec(void *dst, const void *a, const void *b,
+                                     size_t n, size_t w) {
+    unsigned char       *d = dst;
+    const unsigned char *x = a, *y = b;
+    size_t i = 0;
+
+#ifdef ulHAVEAVX2
+    for (; i < (n & ~(32 / w - 1)); i += 32 / w) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(x + i * w));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(y + i * w));
+        __m256i r  = w == 1 ? _mm256_add_epi8(va, vb)  :
+                     w == 2 ? _mm256_add_epi16(va, vb) :
+                     w == 4 ? _mm256_add_epi32(va, vb) : _mm256_add_epi64(va, vb);
+        _mm256_storeu_si256((__m256i *)(d + i * w), r);
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    for (; i < (n & ~(16 / w - 1)); i += 16 / w) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(x + i * w));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(y + i * w));
+        __m128i r  = w == 1 ? _mm_add_epi8(va, vb)  :
+                     w == 2 ? _mm_add_epi16(va, vb) :
+                     w == 4 ? _mm_add_epi32(va, vb) : _mm_add_epi64(va, vb);
+        _mm_storeu_si128((__m128i *)(d + i * w), r);
+    }
+#endif
+
+    (void)d; (void)x; (void)y; (void)n; (void)w;
+    return i;
+}
+
+
+// Sum of the w-byte lanes in buf, modulo 2^64
+static inline uint64_t ul__addwrap_lanes(const unsigned char *buf, size_t nb, size_t w) {
+    uint64_t s = 0;
+    for (size_t k = 0; k < nb; k += w) {
+        if      (w == 1) { s += buf[k]; }
+        else if (w == 2) { uint16_t v; memcpy(&v, buf + k, 2); s += v; }
+        else if (w == 4) { uint32_t v; memcpy(&v, buf + k, 4); s += v; }
+        else             { uint64_t v; memcpy(&v, buf + k, 8); s += v; }
+    }
+    return s;
+}
+
+
+// Vector part of a w-byte-lane sum; stores it in *sum, returns elements done
+static inline size_t ul__addwrap_vsum(const void *a, size_t n, size_t w, uint64_t *sum) {
+    const unsigned char *x = a;
+    unsigned char lanes[32];
+    size_t i = 0;
+
+    *sum = 0;
+
+#ifdef ulHAVEAVX2
+    if (n >= 32 / w) {
+        __m256i acc = _mm256_setzero_si256();
+        for (; i < (n & ~(32 / w - 1)); i += 32 / w) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(x + i * w));
+            acc = w == 1 ? _mm256_add_epi8(acc, v)  :
+                  w == 2 ? _mm256_add_epi16(acc, v) :
+                  w == 4 ? _mm256_add_epi32(acc, v) : _mm256_add_epi64(acc, v);
+        }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        *sum += ul__addwrap_lanes(lanes, 32, w);
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    if (n - i >= 16 / w) {
+        __m128i acc = _mm_setzero_si128();
+        for (; i < (n & ~(16 / w - 1)); i += 16 / w) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(x + i * w));
+            acc = w == 1 ? _mm_add_epi8(acc, v)  :
+                  w == 2 ? _mm_add_epi16(acc, v) :
+                  w == 4 ? _mm_add_epi32(acc, v) : _mm_add_epi64(acc, v);
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        *sum += ul__addwrap_lanes(lanes, 16, w);
+    }
+#endif
+
+    (void)x; (void)lanes; (void)n; (void)w;
+    return i;
+}
+
+
+static inline void uladdwrapchar_n(char *dst, const char *a, const char *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwrapchar(a[i], b[i]);
+}
+
+static inline void uladdwrapsignedchar_n(signed char *dst, const signed char *a,
+                                         const signed char *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwrapsignedchar(a[i], b[i]);
+}
+
+static inline void uladdwrapshort_n(short *dst, const short *a, const short *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwrapshort(a[i], b[i]);
+}
+
+static inline void uladdwrapint_n(int *dst, const int *a, const int *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwrapint(a[i], b[i]);
+}
+
+static inline void uladdwraplong_n(long *dst, const long *a, const long *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwraplong(a[i], b[i]);
+}
+
+static inline void uladdwraplonglong_n(long long *dst, const long long *a,
+                                       const long long *b, size_t n) {
+    for (size_t i = ul__addwrap_vec(dst, a, b, n, sizeof *a); i < n; i++)
+        dst[i] = uladdwraplonglong(a[i], b[i]);
+}
+
+
+static inline char uladdwrapchar_reduce(const char *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned char u = (unsigned char)s;
+    for (; i < n; i++) u = (unsigned char)(u + (unsigned char)a[i]);
+#if SCHAR_MIN == CHAR_MIN
+    return ul__TOSIGNED(u, char, unsigned char, CHAR_MIN, CHAR_MAX);
+#else
+    return (char)u;
+#endif
+}
+
+static inline signed char uladdwrapsignedchar_reduce(const signed char *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned char u = (unsigned char)s;
+    for (; i < n; i++) u = (unsigned char)(u + (unsigned char)a[i]);
+    return ul__TOSIGNED(u, signed char, unsigned char, SCHAR_MIN, SCHAR_MAX);
+}
+
+static inline short uladdwrapshort_reduce(const short *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned short u = (unsigned short)s;
+    for (; i < n; i++) u = (unsigned short)(u + (unsigned short)a[i]);
+    return ul__TOSIGNED(u, short, unsigned short, SHRT_MIN, SHRT_MAX);
+}
+
+static inline int uladdwrapint_reduce(const int *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned u = (unsigned)s;
+    for (; i < n; i++) u += (unsigned)a[i];
+    return ul__TOSIGNED(u, int, unsigned, INT_MIN, INT_MAX);
+}
+
+static inline long uladdwraplong_reduce(const long *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned long u = (unsigned long)s;
+    for (; i < n; i++) u += (unsigned long)a[i];
+    return ul__TOSIGNED(u, long, unsigned long, LONG_MIN, LONG_MAX);
+}
+
+static inline long long uladdwraplonglong_reduce(const long long *a, size_t n) {
+    uint64_t s;
+    size_t i = ul__addwrap_vsum(a, n, sizeof *a, &s);
+    unsigned long long u = (unsigned long long)s;
+    for (; i < n; i++) u += (unsigned long long)a[i];
+    return ul__TOSIGNED(u, long long, unsigned long long, LLONG_MIN, LLONG_MAX);
 }
 
 
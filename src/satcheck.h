@@ -0,0 +1,297 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+#ifndef SATCHECK_H__
+#define SATCHECK_H__
+
+#include "addwrap.h"
+
+// #define ulCROWDEDNAMESPACE
+#ifndef ulCROWDEDNAMESPACE
+  #define addsat(...)          uladdsat(__VA_ARGS__)
+  #define subsat(...)          ulsubsat(__VA_ARGS__)
+  #define mulsat(...)          ulmulsat(__VA_ARGS__)
+  #define addcheck(...)        uladdcheck(__VA_ARGS__)
+  #define subcheck(...)        ulsubcheck(__VA_ARGS__)
+  #define mulcheck(...)        ulmulcheck(__VA_ARGS__)
+  #define addsat_n(...)        uladdsat_n(__VA_ARGS__)
+  #define subsat_n(...)        ulsubsat_n(__VA_ARGS__)
+#endif
+
+//===========================================================================
+//             Saturating and checked add, subtract, and multiply
+//===========================================================================
+// uladdsat(a, b), ulsubsat(a, b), ulmulsat(a, b)
+//     Return the exact result clamped to the range of the operation's type.
+//
+// uladdcheck(a, b, &r), ulsubcheck(a, b, &r), ulmulcheck(a, b, &r)
+//     Store the wrapped result in r and return 1 if the exact result did not
+//     fit, else 0. r must point to the operation's type.
+//
+// uladdsat_n(dst, a, b, n), ulsubsat_n(dst, a, b, n)
+//     Element-wise saturating add/subtract over arrays, dispatched on the
+//     element type of dst. dst may be a or b. 8- and 16-bit elements use the
+//     AVX2/SSE2 saturating instructions; 32- and 64-bit ones have none, so
+//     they add or subtract with wraparound, derive an overflow mask from the
+//     sign bits, and blend in MIN or MAX without branches.
+//
+// The operation's type is the usual arithmetic conversion of a and b, except
+// that two operands of the same type narrower than int keep that type, as
+// with uladdwrap. With GCC and Clang everything is built on the
+// __builtin_*_overflow intrinsics, which compile to the add/sub/mul and a
+// test of the overflow or carry flag; elsewhere on portable range checks.
+//
+// Each type has its own functions too, named like uladdsatunsignedshort(),
+// ulmulchecklonglong(), or ulsubsatint_n().
+
+#define ul__SATNARROW(op, a, b) _Generic((a),                                  \
+                  char: _Generic((b), char:           ul##op##char,            \
+                                      default:        ul##op##int),            \
+           signed char: _Generic((b), signed char:    ul##op##signedchar,      \
+                                      default:        ul##op##int),            \
+         unsigned char: _Generic((b), unsigned char:  ul##op##unsignedchar,    \
+                                      default:        ul##op##int),            \
+                 short: _Generic((b), short:          ul##op##short,           \
+                                      default:        ul##op##int),            \
+        unsigned short: _Generic((b), unsigned short: ul##op##unsignedshort,   \
+                                      default:        ul##op##int),            \
+               default: ul##op##int)
+
+#define ul__SATDISPATCH(op, a, b) _Generic((a) + (b),                          \
+                   int: ul__SATNARROW(op, a, b),                               \
+              unsigned: ul##op##unsigned,                                      \
+                  long: ul##op##long,                                          \
+         unsigned long: ul##op##unsignedlong,                                  \
+             long long: ul##op##longlong,                                      \
+    unsigned long long: ul##op##unsignedlonglong)
+
+#define uladdsat(a, b)       ul__SATDISPATCH(addsat, a, b)(a, b)
+#define ulsubsat(a, b)       ul__SATDISPATCH(subsat, a, b)(a, b)
+#define ulmulsat(a, b)       ul__SATDISPATCH(mulsat, a, b)(a, b)
+#define uladdcheck(a, b, r)  ul__SATDISPATCH(addcheck, a, b)(a, b, r)
+#define ulsubcheck(a, b, r)  ul__SATDISPATCH(subcheck, a, b)(a, b, r)
+#define ulmulcheck(a, b, r)  ul__SATDISPATCH(mulcheck, a, b)(a, b, r)
+
+#define ul__SATARRAY(op, dst) _Generic((dst),                                  \
+                  char *: ul##op##char_n,                                      \
+           signed char *: ul##op##signedchar_n,                                \
+         unsigned char *: ul##op##unsignedchar_n,                              \
+                 short *: ul##op##short_n,                                     \
+        unsigned short *: ul##op##unsignedshort_n,                             \
+                   int *: ul##op##int_n,                                       \
+              unsigned *: ul##op##unsigned_n,                                  \
+                  long *: ul##op##long_n,                                      \
+         unsigned long *: ul##op##unsignedlong_n,                              \
+             long long *: ul##op##longlong_n,                                  \
+    unsigned long long *: ul##op##unsignedlonglong_n)
+
+#define uladdsat_n(dst, a, b, n)  ul__SATARRAY(addsat, dst)(dst, a, b, n)
+#define ulsubsat_n(dst, a, b, n)  ul__SATARRAY(subsat, dst)(dst, a, b, n)
+
+
+// 32- and 64-bit saturation from the wrapped result r. The top bit of ovf
+// is set where the exact result did not fit: for signed add, where r's sign
+// differs from both operands'; for signed subtract, where a and b differ in
+// sign and r differs from a; for unsigned, the carry or borrow out of the
+// top bit. Signed lanes that overflowed become MAX if a >= 0, else MIN. SSE2
+// has no 64-bit arithmetic shift, so spreading a sign bit over a 64-bit lane
+// shifts 32-bit halves and copies each high half down.
+#define ul__SATWIDEFN(pfx, V, S)                                               \
+static inline V ul__satspread##S(V m, size_t w) {                              \
+    m = pfx##_srai_epi32(m, 31);                                               \
+    return w == 4 ? m : pfx##_shuffle_epi32(m, 0xF5);                          \
+}                                                                              \
+static inline V ul__satwide##S(V a, V b, size_t w, int issigned, int sub) {    \
+    V r = w == 4 ? (sub ? pfx##_sub_epi32(a, b) : pfx##_add_epi32(a, b))       \
+                 : (sub ? pfx##_sub_epi64(a, b) : pfx##_add_epi64(a, b));      \
+    V ovf, lim;                                                                \
+    if (issigned) {                                                            \
+        ovf = sub ? pfx##_and_##S(pfx##_xor_##S(a, b), pfx##_xor_##S(a, r))    \
+                  : pfx##_and_##S(pfx##_xor_##S(a, r), pfx##_xor_##S(b, r));   \
+        lim = w == 4 ? pfx##_set1_epi32(INT32_MAX)                             \
+                     : pfx##_set1_epi64x(INT64_MAX);                           \
+        lim = pfx##_xor_##S(lim, ul__satspread##S(a, w));                      \
+    } else {                                                                   \
+        ovf = sub ? pfx##_or_##S(pfx##_andnot_##S(a, b),                       \
+                                 pfx##_andnot_##S(pfx##_xor_##S(a, b), r))     \
+                  : pfx##_or_##S(pfx##_and_##S(a, b),                          \
+                                 pfx##_andnot_##S(r, pfx##_or_##S(a, b)));     \
+        lim = sub ? pfx##_setzero_##S() : pfx##_set1_epi32(-1);                \
+    }                                                                          \
+    ovf = ul__satspread##S(ovf, w);                                            \
+    return pfx##_or_##S(pfx##_and_##S(ovf, lim), pfx##_andnot_##S(ovf, r));    \
+}
+
+#ifdef ulHAVEAVX2
+ul__SATWIDEFN(_mm256, __m256i, si256)
+#endif
+#ifdef ulHAVESSE2
+ul__SATWIDEFN(_mm, __m128i, si128)
+#endif
+
+// Vector part of a saturating add (sub = 0) or subtract (sub = 1) with
+// w-byte lanes; returns elements done. 1- and 2-byte lanes have saturating
+// instructions; 4- and 8-byte lanes go through ul__satwide.
+static inline size_t ul__sat_vec(void *dst, const void *a, const void *b,
+                                 size_t n, size_t w, int issigned, int sub) {
+    unsigned char       *d = dst;
+    const unsigned char *x = a, *y = b;
+    size_t i = 0;
+
+#ifdef ulHAVEAVX2
+    for (; i < (n & ~(32 / w - 1)); i += 32 / w) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(x + i * w));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(y + i * w)), r;
+        if (w == 1)      r = issigned ? (sub ? _mm256_subs_epi8(va, vb)  : _mm256_adds_epi8(va, vb))
+                                      : (sub ? _mm256_subs_epu8(va, vb)  : _mm256_adds_epu8(va, vb));
+        else if (w == 2) r = issigned ? (sub ? _mm256_subs_epi16(va, vb) : _mm256_adds_epi16(va, vb))
+                                      : (sub ? _mm256_subs_epu16(va, vb) : _mm256_adds_epu16(va, vb));
+        else             r = ul__satwidesi256(va, vb, w, issigned, sub);
+        _mm256_storeu_si256((__m256i *)(d + i * w), r);
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    for (; i < (n & ~(16 / w - 1)); i += 16 / w) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(x + i * w));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(y + i * w)), r;
+        if (w == 1)      r = issigned ? (sub ? _mm_subs_epi8(va, vb)  : _mm_adds_epi8(va, vb))
+                                      : (sub ? _mm_subs_epu8(va, vb)  : _mm_adds_epu8(va, vb));
+        else if (w == 2) r = issigned ? (sub ? _mm_subs_epi16(va, vb) : _mm_adds_epi16(va, vb))
+                                      : (sub ? _mm_subs_epu16(va, vb) : _mm_adds_epu16(va, vb));
+        else             r = ul__satwidesi128(va, vb, w, issigned, sub);
+        _mm_storeu_si128((__m128i *)(d + i * w), r);
+    }
+#endif
+
+    (void)d; (void)x; (void)y; (void)n; (void)w; (void)issigned; (void)sub;
+    return i;
+}
+
+
+// Checked operations
+// ------------------
+// The portable versions test the operands against the type's limits before
+// operating, then compute the wrapped result in the unsigned type (at least
+// unsigned int, so narrow types cannot promote into signed overflow).
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+
+#define ul__SATCHECK(name, T, UT, MIN, MAX)                                    \
+static inline int uladdcheck##name(T a, T b, T *r) {                           \
+    return __builtin_add_overflow(a, b, r);                                    \
+}                                                                              \
+static inline int ulsubcheck##name(T a, T b, T *r) {                           \
+    return __builtin_sub_overflow(a, b, r);                                    \
+}                                                                              \
+static inline int ulmulcheck##name(T a, T b, T *r) {                           \
+    return __builtin_mul_overflow(a, b, r);                                    \
+}
+
+#else
+
+#define ul__SATCHECK(name, T, UT, MIN, MAX)                                    \
+static inline int uladdcheck##name(T a, T b, T *r) {                           \
+    UT u = (UT)(1U * (UT)a + (UT)b);                                           \
+    *r = ul__TOSIGNED(u, T, UT, MIN, MAX);                                     \
+    return b > 0 ? a > (T)(MAX - b) : a < (T)(MIN - b);                        \
+}                                                                              \
+static inline int ulsubcheck##name(T a, T b, T *r) {                           \
+    UT u = (UT)(1U * (UT)a - (UT)b);                                           \
+    *r = ul__TOSIGNED(u, T, UT, MIN, MAX);                                     \
+    return b > 0 ? a < (T)(MIN + b) : a > (T)(MAX + b);                        \
+}                                                                              \
+static inline int ulmulcheck##name(T a, T b, T *r) {                           \
+    UT u = (UT)(1U * (UT)a * (UT)b);                                           \
+    *r = ul__TOSIGNED(u, T, UT, MIN, MAX);                                     \
+    if (a > 0) return b > 0 ? a > (T)(MAX / b) : b < (T)(MIN / a);             \
+    if (a < 0) return b > 0 ? a < (T)(MIN / b) : b != 0 && b < (T)(MAX / a);   \
+    return 0;                                                                  \
+}
+
+#endif
+
+
+// Saturating operations
+// ---------------------
+// Overflow direction follows from the operand signs, so each function is the
+// checked operation plus a select of MIN or MAX.
+
+#define ul__SATSIGNED(name, T, UT, MIN, MAX)                                   \
+ul__SATCHECK(name, T, UT, MIN, MAX)                                            \
+static inline T uladdsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return uladdcheck##name(a, b, &r) ? (b > 0 ? MAX : MIN) : r;               \
+}                                                                              \
+static inline T ulsubsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return ulsubcheck##name(a, b, &r) ? (b > 0 ? MIN : MAX) : r;               \
+}                                                                              \
+static inline T ulmulsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return ulmulcheck##name(a, b, &r) ? ((a > 0) == (b > 0) ? MAX : MIN) : r;  \
+}                                                                              \
+ul__SATARRAYFN(name, T, 1)
+
+#define ul__SATUNSIGNED(name, T, MAX)                                          \
+ul__SATCHECK(name, T, T, 0, MAX)                                               \
+static inline T uladdsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return uladdcheck##name(a, b, &r) ? MAX : r;                               \
+}                                                                              \
+static inline T ulsubsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return ulsubcheck##name(a, b, &r) ? 0 : r;                                 \
+}                                                                              \
+static inline T ulmulsat##name(T a, T b) {                                     \
+    T r;                                                                       \
+    return ulmulcheck##name(a, b, &r) ? MAX : r;                               \
+}                                                                              \
+ul__SATARRAYFN(name, T, 0)
+
+#define ul__SATARRAYFN(name, T, ISSIGNED)                                      \
+static inline void uladdsat##name##_n(T *dst, const T *a, const T *b, size_t n) { \
+    size_t i = ul__sat_vec(dst, a, b, n, sizeof(T), ISSIGNED, 0);              \
+    for (; i < n; i++) dst[i] = uladdsat##name(a[i], b[i]);                    \
+}                                                                              \
+static inline void ulsubsat##name##_n(T *dst, const T *a, const T *b, size_t n) { \
+    size_t i = ul__sat_vec(dst, a, b, n, sizeof(T), ISSIGNED, 1);              \
+    for (; i < n; i++) dst[i] = ulsubsat##name(a[i], b[i]);                    \
+}
+
+#if CHAR_MIN < 0
+ul__SATSIGNED(char, char, unsigned char, CHAR_MIN, CHAR_MAX)
+#else
+ul__SATUNSIGNED(char, char, CHAR_MAX)
+#endif
+ul__SATSIGNED(signedchar, signed char, unsigned char, SCHAR_MIN, SCHAR_MAX)
+ul__SATSIGNED(short, short, unsigned short, SHRT_MIN, SHRT_MAX)
+ul__SATSIGNED(int, int, unsigned, INT_MIN, INT_MAX)
+ul__SATSIGNED(long, long, unsigned long, LONG_MIN, LONG_MAX)
+ul__SATSIGNED(longlong, long long, unsigned long long, LLONG_MIN, LLONG_MAX)
+ul__SATUNSIGNED(unsignedchar, unsigned char, UCHAR_MAX)
+ul__SATUNSIGNED(unsignedshort, unsigned short, USHRT_MAX)
+ul__SATUNSIGNED(unsigned, unsigned, UINT_MAX)
+ul__SATUNSIGNED(unsignedlong, unsigned long, ULONG_MAX)
+ul__SATUNSIGNED(unsignedlonglong, unsigned long long, ULLONG_MAX)
+
+
+#endif
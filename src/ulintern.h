@@ -0,0 +1,434 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+#ifndef ULINTERN_H__
+#define ULINTERN_H__
+
+#include "ulslice.h"
+
+// #define ulCROWDEDNAMESPACE
+#ifndef ulCROWDEDNAMESPACE
+  #define intern_create(...)   ulintern_create(__VA_ARGS__)
+  #define intern_destroy(...)  ulintern_destroy(__VA_ARGS__)
+  #define intern_mem(...)      ulintern_mem(__VA_ARGS__)
+  #define intern_str(...)      ulintern_str(__VA_ARGS__)
+  #define intern_slice(...)    ulintern_slice(__VA_ARGS__)
+  #define intern_find(...)     ulintern_find(__VA_ARGS__)
+  #define intern_count(...)    ulintern_count(__VA_ARGS__)
+  #define intern_bytes(...)    ulintern_bytes(__VA_ARGS__)
+  #define internshared_create(...)  ulinternshared_create(__VA_ARGS__)
+  #define internshared_destroy(...) ulinternshared_destroy(__VA_ARGS__)
+  #define internshared_mem(...)     ulinternshared_mem(__VA_ARGS__)
+  #define internshared_str(...)     ulinternshared_str(__VA_ARGS__)
+  #define internshared_slice(...)   ulinternshared_slice(__VA_ARGS__)
+  #define internshared_find(...)    ulinternshared_find(__VA_ARGS__)
+  #define internshared_count(...)   ulinternshared_count(__VA_ARGS__)
+  #define internshared_bytes(...)   ulinternshared_bytes(__VA_ARGS__)
+#endif
+
+//===========================================================================
+//                              String interning
+//===========================================================================
+// An intern table keeps one copy of each distinct string and hands back the
+// same canonical pointer every time that string is interned, so interned
+// strings are compared with == and never freed one by one. The canonical
+// copies are NUL-terminated and stay valid, at the same address, until the
+// table is destroyed; they must not be written.
+//
+//     ulintern *names = ulintern_create(0);
+//     const char *k = ulintern_str(names, "Content-Type");
+//     if (k == ulintern_str(names, hdr)) ...
+//     ulintern_destroy(names);
+//
+// ulintern_mem() and ulintern_slice() take a length, so keys need not be
+// NUL-terminated. ulintern_find() looks a string up without adding it and
+// returns NULL if it has not been interned. Interning returns NULL only if
+// memory runs out (or a key is 4 GiB or longer). ulintern_bytes() reports
+// the memory the table holds: its slots plus its string blocks.
+//
+// The table is open-addressed with linear probing, keyed by ulhashbytes()
+// under a per-table seed. Each 16-byte slot holds the canonical pointer, the
+// length, and 32 bits of the hash, so a probe touches the string only when
+// the length and hash bits both match. The strings are packed end to end,
+// without alignment padding, into blocks from a ularena that start small and
+// grow to ulINTERNBLOCK bytes.
+//
+// A ulintern is for one thread at a time. ulinternshared (POSIX) is the
+// same table split into ulINTERNSHARDS shards by hash, for interning from
+// many threads. Lookups of strings already present take no lock: a slot's
+// pointer is published last, with release ordering, and a full shard moves
+// to a larger table without disturbing the old one, which readers may still
+// be probing. The old tables are freed with the whole table. Adding a new
+// string locks only its shard.
+
+#ifndef ulINTERNBLOCK
+#define ulINTERNBLOCK    16384
+#endif
+
+#ifndef ulINTERNSHARDS
+#define ulINTERNSHARDS   16            // Power of two
+#endif
+
+typedef struct ul__internslot {
+    const char *_Atomic  str;          // Canonical copy, or NULL if empty
+    uint32_t             len;
+    uint32_t             tag;          // High half of the hash
+} ul__internslot;
+
+typedef struct ul__interntab {
+    struct ul__interntab *retired;     // Smaller tables this one replaced
+    size_t                mask;
+    ul__internslot        slot[];
+} ul__interntab;
+
+typedef struct ul__internshard {
+    ul__interntab *_Atomic tab;
+    size_t          nslots;
+    size_t          count;             // Distinct strings
+    size_t          blockbytes;        // Bytes of string blocks allocated
+    int             keepold;           // Retire replaced tables, don't free
+    ularena        *arena;
+    char           *blk;               // Free tail of the current block
+    size_t          blkleft;
+} ul__internshard;
+
+typedef struct ulintern {
+    ul__internshard  sh;
+    uint64_t         seed;
+} ulintern;
+
+
+static inline uint64_t ul__intern_seed(const void *t) {
+    return ul__hashmix((uint64_t)(uintptr_t)t ^ (uint64_t)time(NULL));
+}
+
+
+static inline ul__interntab *ul__interntab_new(size_t nslots) {
+    ul__interntab *t = calloc(1, sizeof *t + nslots * sizeof t->slot[0]);
+    if (t) t->mask = nslots - 1;
+    return t;
+}
+
+
+static inline int ul__internshard_init(ul__internshard *sh, size_t expected, int keepold) {
+    size_t n = 16;
+    while (n / 4 * 3 < expected && n < SIZE_MAX / 4) n *= 2;
+
+    memset(sh, 0, sizeof *sh);
+    sh->keepold = keepold;
+    if ((sh->arena = ularena_create(256)) == NULL) return -1;
+    if ((sh->tab = ul__interntab_new(n)) == NULL) {
+        ularena_destroy(sh->arena);
+        return -1;
+    }
+    sh->nslots = n;
+    return 0;
+}
+
+
+static inline void ul__internshard_free(ul__internshard *sh) {
+    ul__interntab *t = atomic_load_explicit(&sh->tab, memory_order_relaxed);
+    while (t) {
+        ul__interntab *r = t->retired;
+        (free)(t);
+        t = r;
+    }
+    ularena_destroy(sh->arena);
+}
+
+
+// The canonical copy of s[0, n) in t, or NULL with *at set to the empty slot
+// where it belongs. Safe to call while another thread inserts into t.
+static inline const char *ul__intern_probe(ul__interntab *t, const char *s, size_t n,
+                                           uint32_t tag, size_t *at) {
+    size_t i = tag & t->mask;
+    for (;; i = (i + 1) & t->mask) {
+        ul__internslot *sl = &t->slot[i];
+        const char *p = atomic_load_explicit(&sl->str, memory_order_acquire);
+        if (!p) { *at = i; return NULL; }
+        if (sl->tag == tag && sl->len == n && !memcmp(p, s, n)) return p;
+    }
+}
+
+
+static inline ul__interntab *ul__intern_grow(ul__internshard *sh, ul__interntab *old) {
+    ul__interntab *t = ul__interntab_new(sh->nslots * 2);
+    size_t i, j;
+
+    if (!t) return NULL;
+    for (i = 0; i <= old->mask; i++) {
+        ul__internslot *sl = &old->slot[i];
+        const char *p = atomic_load_explicit(&sl->str, memory_order_relaxed);
+        if (!p) continue;
+        for (j = sl->tag & t->mask; t->slot[j].str; j = (j + 1) & t->mask);
+        t->slot[j].len = sl->len;
+        t->slot[j].tag = sl->tag;
+        atomic_store_explicit(&t->slot[j].str, p, memory_order_relaxed);
+    }
+
+    if (sh->keepold) t->retired = old;
+    else             (free)(old);
+    sh->nslots *= 2;
+    atomic_store_explicit(&sh->tab, t, memory_order_release);
+    return t;
+}
+
+
+// Copy s[0, n) into the current block, starting a new one if it won't fit
+static inline char *ul__intern_store(ul__internshard *sh, const char *s, size_t n) {
+    char *q;
+
+    if (sh->blkleft < n + 1) {
+        // Blocks double from 256 bytes up to ulINTERNBLOCK; long strings
+        // get a block of their own
+        size_t z = sh->blockbytes < 256 ? 256 :
+                   sh->blockbytes < ulINTERNBLOCK ? sh->blockbytes : ulINTERNBLOCK;
+        if (n + 1 > z / 4) z = n + 1;
+        if ((q = ularena_alloc(sh->arena, z)) == NULL) return NULL;
+        sh->blockbytes += z;
+        if (z == n + 1) {
+            memcpy(q, s, n);
+            q[n] = '\0';
+            return q;
+        }
+        sh->blk = q;
+        sh->blkleft = z;
+    }
+
+    q = sh->blk;
+    sh->blk += n + 1;
+    sh->blkleft -= n + 1;
+    memcpy(q, s, n);
+    q[n] = '\0';
+    return q;
+}
+
+
+// Find or add s[0, n). Writers to one shard must be serialized.
+static inline const char *ul__intern_insert(ul__internshard *sh, const char *s, size_t n,
+                                            uint32_t tag) {
+    ul__interntab *t = atomic_load_explicit(&sh->tab, memory_order_relaxed);
+    const char *p;
+    char *q;
+    size_t at;
+
+    if ((p = ul__intern_probe(t, s, n, tag, &at)) != NULL) return p;
+
+    if ((sh->count + 1) * 4 > sh->nslots * 3) {
+        if ((t = ul__intern_grow(sh, t)) == NULL) return NULL;
+        ul__intern_probe(t, s, n, tag, &at);
+    }
+    if ((q = ul__intern_store(sh, s, n)) == NULL) return NULL;
+
+    t->slot[at].len = (uint32_t)n;
+    t->slot[at].tag = tag;
+    atomic_store_explicit(&t->slot[at].str, q, memory_order_release);
+    sh->count++;
+    return q;
+}
+
+
+static inline size_t ul__internshard_bytes(const ul__internshard *sh) {
+    return sizeof(ul__interntab) + sh->nslots * sizeof(ul__internslot) + sh->blockbytes;
+}
+
+
+
+// Single-threaded table
+// ---------------------
+
+static inline ulintern *ulintern_create(size_t expected) {
+    ulintern *t = malloc(sizeof *t);
+    if (!t) return NULL;
+    if (ul__internshard_init(&t->sh, expected, 0) != 0) {
+        (free)(t);
+        return NULL;
+    }
+    t->seed = ul__intern_seed(t);
+    return t;
+}
+
+
+static inline void ulintern_destroy(ulintern *t) {
+    if (!t) return;
+    ul__internshard_free(&t->sh);
+    (free)(t);
+}
+
+
+static inline const char *ulintern_mem(ulintern *t, const char *s, size_t n) {
+    if (n > UINT32_MAX) return NULL;
+    return ul__intern_insert(&t->sh, s, n, (uint32_t)(ulhashbytes(s, n, t->seed) >> 32));
+}
+
+
+static inline const char *ulintern_str(ulintern *t, const char *s) {
+    return ulintern_mem(t, s, strlen(s));
+}
+
+
+static inline const char *ulintern_slice(ulintern *t, ulslice s) {
+    return ulintern_mem(t, s.ptr, s.len);
+}
+
+
+static inline const char *ulintern_find(ulintern *t, const char *s, size_t n) {
+    size_t at;
+    if (n > UINT32_MAX) return NULL;
+    return ul__intern_probe(atomic_load_explicit(&t->sh.tab, memory_order_relaxed), s, n,
+                            (uint32_t)(ulhashbytes(s, n, t->seed) >> 32), &at);
+}
+
+
+static inline size_t ulintern_count(const ulintern *t) {
+    return t->sh.count;
+}
+
+
+static inline size_t ulintern_bytes(const ulintern *t) {
+    return sizeof *t + ul__internshard_bytes(&t->sh);
+}
+
+
+
+#ifdef ulHAVEPOSIX
+
+#include <pthread.h>
+
+// Concurrent table
+// ----------------
+// The low bits of the hash pick the shard; the high half places the string
+// within it. Shards are cache-line aligned so writers to different shards
+// do not contend.
+
+typedef struct ul__internlocked {
+    _Alignas(64) pthread_mutex_t lock;
+    ul__internshard              sh;
+} ul__internlocked;
+
+typedef struct ulinternshared {
+    ul__internlocked  shard[ulINTERNSHARDS];
+    uint64_t          seed;
+} ulinternshared;
+
+
+static inline ulinternshared *ulinternshared_create(size_t expected) {
+    ulinternshared *t = aligned_alloc(_Alignof(ulinternshared), sizeof *t);
+    int i;
+
+    if (!t) return NULL;
+    for (i = 0; i < ulINTERNSHARDS; i++) {
+        if (ul__internshard_init(&t->shard[i].sh, expected / ulINTERNSHARDS, 1) != 0) {
+            while (i-- > 0) {
+                ul__internshard_free(&t->shard[i].sh);
+                pthread_mutex_destroy(&t->shard[i].lock);
+            }
+            (free)(t);
+            return NULL;
+        }
+        pthread_mutex_init(&t->shard[i].lock, NULL);
+    }
+    t->seed = ul__intern_seed(t);
+    return t;
+}
+
+
+static inline void ulinternshared_destroy(ulinternshared *t) {
+    if (!t) return;
+    for (int i = 0; i < ulINTERNSHARDS; i++) {
+        ul__internshard_free(&t->shard[i].sh);
+        pthread_mutex_destroy(&t->shard[i].lock);
+    }
+    (free)(t);
+}
+
+
+static inline const char *ulinternshared_find(ulinternshared *t, const char *s, size_t n) {
+    uint64_t h;
+    size_t at;
+    if (n > UINT32_MAX) return NULL;
+    h = ulhashbytes(s, n, t->seed);
+    return ul__intern_probe(
+        atomic_load_explicit(&t->shard[h & (ulINTERNSHARDS - 1)].sh.tab, memory_order_acquire),
+        s, n, (uint32_t)(h >> 32), &at);
+}
+
+
+static inline const char *ulinternshared_mem(ulinternshared *t, const char *s, size_t n) {
+    ul__internlocked *sd;
+    const char *p;
+    uint64_t h;
+    size_t at;
+
+    if (n > UINT32_MAX) return NULL;
+    h  = ulhashbytes(s, n, t->seed);
+    sd = &t->shard[h & (ulINTERNSHARDS - 1)];
+
+    p = ul__intern_probe(atomic_load_explicit(&sd->sh.tab, memory_order_acquire),
+                         s, n, (uint32_t)(h >> 32), &at);
+    if (p) return p;
+
+    pthread_mutex_lock(&sd->lock);
+    p = ul__intern_insert(&sd->sh, s, n, (uint32_t)(h >> 32));
+    pthread_mutex_unlock(&sd->lock);
+    return p;
+}
+
+
+static inline const char *ulinternshared_str(ulinternshared *t, const char *s) {
+    return ulinternshared_mem(t, s, strlen(s));
+}
+
+
+static inline const char *ulinternshared_slice(ulinternshared *t, ulslice s) {
+    return ulinternshared_mem(t, s.ptr, s.len);
+}
+
+
+// Totals lock each shard in turn, so they are exact only when no thread is
+// interning concurrently. Bytes include tables kept for concurrent readers.
+static inline size_t ulinternshared_count(ulinternshared *t) {
+    size_t z = 0;
+    for (int i = 0; i < ulINTERNSHARDS; i++) {
+        pthread_mutex_lock(&t->shard[i].lock);
+        z += t->shard[i].sh.count;
+        pthread_mutex_unlock(&t->shard[i].lock);
+    }
+    return z;
+}
+
+
+static inline size_t ulinternshared_bytes(ulinternshared *t) {
+    size_t z = sizeof *t;
+    for (int i = 0; i < ulINTERNSHARDS; i++) {
+        ul__interntab *r;
+        pthread_mutex_lock(&t->shard[i].lock);
+        z += ul__internshard_bytes(&t->shard[i].sh);
+        r = atomic_load_explicit(&t->shard[i].sh.tab, memory_order_relaxed)->retired;
+        for (; r; r = r->retired) z += sizeof *r + (r->mask + 1) * sizeof r->slot[0];
+        pthread_mutex_unlock(&t->shard[i].lock);
+    }
+    return z;
+}
+
+#endif
+
+#endif
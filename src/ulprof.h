@@ -0,0 +1,322 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+#ifndef ULPROF_H__
+#define ULPROF_H__
+
+#include "utillib.h"
+
+// #define ulCROWDEDNAMESPACE
+// #define ulNEEDPROF
+#ifndef ulCROWDEDNAMESPACE
+  #define COUNT(...)           ulCOUNT(__VA_ARGS__)
+  #define COUNTN(...)          ulCOUNTN(__VA_ARGS__)
+  #define TIMESCOPE(...)       ulTIMESCOPE(__VA_ARGS__)
+  #define TIMESTART(...)       ulTIMESTART(__VA_ARGS__)
+  #define TIMESTOP(...)        ulTIMESTOP(__VA_ARGS__)
+  #define profdump(...)        ulprofdump(__VA_ARGS__)
+#endif
+
+//===========================================================================
+//               Hot-path counters and latency histograms
+//===========================================================================
+// With ulNEEDPROF defined (POSIX only):
+//
+//   ulCOUNT(name), ulCOUNTN(name, n)   Add 1 or n to a named counter
+//   ulTIMESTART(name) ... ulTIMESTOP(name)
+//                                      Time the code between them
+//   ulTIMESCOPE(name)                  Time from here to the end of the
+//                                      enclosing block (GCC/Clang cleanup)
+//   ulprofdump(fp)                     Print count/p50/p99/p999/max per site
+//
+// Names are identifiers. Each macro use is a site with a static descriptor
+// that registers itself on first use. Every thread records into its own
+// counters and log-linear histograms (16 sub-buckets per power of two, so
+// within ~6%) with plain relaxed stores, so recording takes no locks and no
+// atomic read-modify-writes. ulprofdump() merges all threads on demand.
+// When a thread exits its record is handed, counts intact, to the next new
+// thread, so memory is bounded by the most threads recording at once.
+// Without ulNEEDPROF, every macro compiles to nothing.
+
+#ifdef ulNEEDPROF
+
+#include <pthread.h>
+
+#ifndef ulPROFMAXSITES
+#define ulPROFMAXSITES   256
+#endif
+#define ulPROFSUBBITS    4
+#define ulPROFBUCKETS    ((64 - ulPROFSUBBITS + 1) << ulPROFSUBBITS)
+
+enum { ulPROF_COUNTER, ulPROF_TIMER };
+
+typedef struct ul__profsite {
+    const char         *name;
+    const char         *file;
+    int                 line;
+    int                 kind;
+    _Atomic int         idx;           // 1-based once registered, -1 if full
+} ul__profsite;
+
+typedef struct ul__profhist {
+    _Atomic uint64_t    b[ulPROFBUCKETS];
+} ul__profhist;
+
+typedef struct ul__profthread {
+    struct ul__profthread *next;
+    int                 idle;          // Owner exited (under state lock)
+    _Atomic uint64_t    count[ulPROFMAXSITES];
+    _Atomic uint64_t    max[ulPROFMAXSITES];
+    ul__profhist *_Atomic hist[ulPROFMAXSITES];
+} ul__profthread;
+
+typedef struct ul__profstate {
+    pthread_mutex_t     lock;
+    pthread_once_t      once;
+    pthread_key_t       key;
+    int                 nsites;
+    ul__profsite       *site[ulPROFMAXSITES];
+    ul__profthread *_Atomic threads;
+} ul__profstate;
+
+ulSHARED ul__profstate ul__prof_state = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT, 0, 0, { 0 }, NULL
+};
+ulSHARED _Thread_local ul__profthread *ul__prof_tls;
+ulSHARED _Thread_local int ul__prof_nomem;
+
+
+static inline uint64_t ul__prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+
+static inline int ul__prof_bucket(uint64_t v) {
+    int e;
+    if (v < (1U << ulPROFSUBBITS)) return (int)v;
+    for (e = 63; !(v >> e); e--);
+    return ((e - ulPROFSUBBITS + 1) << ulPROFSUBBITS) +
+           (int)((v >> (e - ulPROFSUBBITS)) & ((1U << ulPROFSUBBITS) - 1));
+}
+
+// Highest value that falls in bucket i
+static inline uint64_t ul__prof_bucketmax(int i) {
+    int e, m;
+    if (i < (1 << ulPROFSUBBITS)) return (uint64_t)i;
+    e = (i >> ulPROFSUBBITS) + ulPROFSUBBITS - 1;
+    m = i & ((1 << ulPROFSUBBITS) - 1);
+    return (((uint64_t)((1 << ulPROFSUBBITS) + m) + 1) << (e - ulPROFSUBBITS)) - 1;
+}
+
+
+static inline int ul__prof_register(ul__profsite *s) {
+    int i;
+    pthread_mutex_lock(&ul__prof_state.lock);
+    if ((i = atomic_load_explicit(&s->idx, memory_order_relaxed)) == 0) {
+        if (ul__prof_state.nsites < ulPROFMAXSITES) {
+            ul__prof_state.site[ul__prof_state.nsites] = s;
+            i = ++ul__prof_state.nsites;
+        }
+        else i = -1;
+        atomic_store_explicit(&s->idx, i, memory_order_release);
+    }
+    pthread_mutex_unlock(&ul__prof_state.lock);
+    return i;
+}
+
+
+// Runs on the exiting thread, so anything it records after this (from other
+// destructors) goes through ul__prof_thread() again rather than into a
+// record that another thread may already own
+static inline void ul__prof_threadexit(void *arg) {
+    ul__profthread *t = arg;
+    pthread_mutex_lock(&ul__prof_state.lock);
+    t->idle = 1;
+    pthread_mutex_unlock(&ul__prof_state.lock);
+    ul__prof_tls = NULL;
+}
+
+static inline void ul__prof_init(void) {
+    pthread_key_create(&ul__prof_state.key, ul__prof_threadexit);
+}
+
+static inline ul__profthread *ul__prof_thread(void) {
+    ul__profthread *t;
+
+    if (ul__prof_nomem) return NULL;
+    pthread_once(&ul__prof_state.once, ul__prof_init);
+
+    pthread_mutex_lock(&ul__prof_state.lock);
+    t = atomic_load_explicit(&ul__prof_state.threads, memory_order_relaxed);
+    while (t && !t->idle) t = t->next;
+    if (!t && (t = calloc(1, sizeof *t)) != NULL) {
+        t->next = atomic_load_explicit(&ul__prof_state.threads, memory_order_relaxed);
+        atomic_store_explicit(&ul__prof_state.threads, t, memory_order_release);
+    }
+    if (t) t->idle = 0;
+    pthread_mutex_unlock(&ul__prof_state.lock);
+
+    if (!t) { ul__prof_nomem = 1; return NULL; }
+    pthread_setspecific(ul__prof_state.key, t);
+    return ul__prof_tls = t;
+}
+
+
+static inline void ul__prof_record(ul__profsite *s, uint64_t n) {
+    ul__profthread *t = ul__prof_tls ? ul__prof_tls : ul__prof_thread();
+    int i = atomic_load_explicit(&s->idx, memory_order_acquire);
+
+    if (i == 0) i = ul__prof_register(s);
+    if (i < 0 || !t) return;
+    i--;
+
+    #define ul__PROFBUMP(a, v) atomic_store_explicit(&(a), \
+        atomic_load_explicit(&(a), memory_order_relaxed) + (v), memory_order_relaxed)
+
+    if (s->kind == ulPROF_COUNTER) {
+        ul__PROFBUMP(t->count[i], n);
+        return;
+    }
+
+    ul__profhist *h = atomic_load_explicit(&t->hist[i], memory_order_relaxed);
+    if (!h) {
+        if ((h = calloc(1, sizeof *h)) == NULL) return;
+        atomic_store_explicit(&t->hist[i], h, memory_order_release);
+    }
+    ul__PROFBUMP(t->count[i], 1);
+    ul__PROFBUMP(h->b[ul__prof_bucket(n)], 1);
+    if (n > atomic_load_explicit(&t->max[i], memory_order_relaxed)) {
+        atomic_store_explicit(&t->max[i], n, memory_order_relaxed);
+    }
+
+    #undef ul__PROFBUMP
+}
+
+
+typedef struct ul__profscope {
+    ul__profsite *site;
+    uint64_t      t0;
+} ul__profscope;
+
+static inline void ul__prof_scopeend(ul__profscope *sc) {
+    ul__prof_record(sc->site, ul__prof_now() - sc->t0);
+}
+
+
+static inline uint64_t ul__prof_quantile(const uint64_t *b, uint64_t n, double q) {
+    uint64_t want = (uint64_t)(q * (double)n), seen = 0;
+    if (want >= n) want = n - 1;
+    for (int i = 0; i < ulPROFBUCKETS; i++) {
+        if ((seen += b[i]) > want) return ul__prof_bucketmax(i);
+    }
+    return 0;
+}
+
+
+static inline void ulprofdump(FILE *fp) {
+    static uint64_t b[ulPROFBUCKETS];
+    int nsites;
+
+    pthread_mutex_lock(&ul__prof_state.lock);
+    nsites = ul__prof_state.nsites;
+
+    fprintf(fp, "%-24s %-24s %12s %12s %12s %12s %12s\n",
+            "site", "where", "count", "p50 ns", "p99 ns", "p999 ns", "max ns");
+
+    for (int i = 0; i < nsites; i++) {
+        const ul__profsite *s = ul__prof_state.site[i];
+        uint64_t count = 0, max = 0;
+        char where[64];
+
+        memset(b, 0, sizeof b);
+        for (ul__profthread *t = atomic_load_explicit(&ul__prof_state.threads,
+                memory_order_acquire); t; t = t->next) {
+            ul__profhist *h = atomic_load_explicit(&t->hist[i], memory_order_acquire);
+            uint64_t m = atomic_load_explicit(&t->max[i], memory_order_relaxed);
+            count += atomic_load_explicit(&t->count[i], memory_order_relaxed);
+            if (m > max) max = m;
+            if (h) for (int k = 0; k < ulPROFBUCKETS; k++) {
+                b[k] += atomic_load_explicit(&h->b[k], memory_order_relaxed);
+            }
+        }
+
+        snprintf(where, sizeof where, "%s:%d", s->file, s->line);
+        if (s->kind == ulPROF_COUNTER || count == 0) {
+            fprintf(fp, "%-24s %-24s %12llu\n", s->name, where, (unsigned long long)count);
+            continue;
+        }
+
+        // Histogram totals can trail count by in-flight records; use them
+        uint64_t n = 0, p50, p99, p999;
+        for (int k = 0; k < ulPROFBUCKETS; k++) n += b[k];
+        if (n == 0) n = 1;
+        p50  = ul__prof_quantile(b, n, 0.50);
+        p99  = ul__prof_quantile(b, n, 0.99);
+        p999 = ul__prof_quantile(b, n, 0.999);
+        fprintf(fp, "%-24s %-24s %12llu %12llu %12llu %12llu %12llu\n",
+                s->name, where, (unsigned long long)count,
+                (unsigned long long)(p50  < max ? p50  : max),
+                (unsigned long long)(p99  < max ? p99  : max),
+                (unsigned long long)(p999 < max ? p999 : max),
+                (unsigned long long)max);
+    }
+
+    pthread_mutex_unlock(&ul__prof_state.lock);
+}
+
+
+#define ul__PROFSITE(name, kind) \
+    static ul__profsite ul__ps_##name = { #name, __FILE__, __LINE__, kind, 0 }
+
+#define ulCOUNTN(name, n) do {                                                 \
+    ul__PROFSITE(name, ulPROF_COUNTER);                                        \
+    ul__prof_record(&ul__ps_##name, (uint64_t)(n));                            \
+    } while (0)
+
+#define ulCOUNT(name)        ulCOUNTN(name, 1)
+
+#define ulTIMESTART(name)                                                      \
+    ul__PROFSITE(name, ulPROF_TIMER);                                          \
+    uint64_t ul__pt_##name = ul__prof_now()
+
+#define ulTIMESTOP(name)                                                       \
+    ul__prof_record(&ul__ps_##name, ul__prof_now() - ul__pt_##name)
+
+#define ulTIMESCOPE(name)                                                      \
+    ul__PROFSITE(name, ulPROF_TIMER);                                          \
+    __attribute__((cleanup(ul__prof_scopeend)))                                \
+    ul__profscope ul__pc_##name = { &ul__ps_##name, ul__prof_now() }
+
+#else
+
+#define ulCOUNTN(name, n)    ((void)0)
+#define ulCOUNT(name)        ((void)0)
+#define ulTIMESTART(name)    ((void)0)
+#define ulTIMESTOP(name)     ((void)0)
+#define ulTIMESCOPE(name)    ((void)0)
+#define ulprofdump(fp)       ((void)(fp))
+
+#endif
+
+
+#endif
@@ -0,0 +1,306 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+#ifndef ULSLICE_H__
+#define ULSLICE_H__
+
+#include "utillib.h"
+
+// #define ulCROWDEDNAMESPACE
+#ifndef ulCROWDEDNAMESPACE
+  #define SLICE(...)           ulSLICE(__VA_ARGS__)
+  #define slice_make(...)      ulslice_make(__VA_ARGS__)
+  #define slice_from(...)      ulslice_from(__VA_ARGS__)
+  #define slice_sub(...)       ulslice_sub(__VA_ARGS__)
+  #define slice_ltrim(...)     ulslice_ltrim(__VA_ARGS__)
+  #define slice_rtrim(...)     ulslice_rtrim(__VA_ARGS__)
+  #define slice_trim(...)      ulslice_trim(__VA_ARGS__)
+  #define slice_trimset(...)   ulslice_trimset(__VA_ARGS__)
+  #define slice_cmp(...)       ulslice_cmp(__VA_ARGS__)
+  #define slice_eq(...)        ulslice_eq(__VA_ARGS__)
+  #define slice_eqstr(...)     ulslice_eqstr(__VA_ARGS__)
+  #define slice_startswith(...) ulslice_startswith(__VA_ARGS__)
+  #define slice_endswith(...)  ulslice_endswith(__VA_ARGS__)
+  #define slice_hash(...)      ulslice_hash(__VA_ARGS__)
+  #define hashbytes(...)       ulhashbytes(__VA_ARGS__)
+  #define slice_charfirstptr(...) ulslice_charfirstptr(__VA_ARGS__)
+  #define slice_charlastptr(...)  ulslice_charlastptr(__VA_ARGS__)
+  #define slice_strfirstptr(...)  ulslice_strfirstptr(__VA_ARGS__)
+  #define slice_strlastptr(...)   ulslice_strlastptr(__VA_ARGS__)
+  #define slice_cut(...)       ulslice_cut(__VA_ARGS__)
+  #define slice_split(...)     ulslice_split(__VA_ARGS__)
+  #define slice_splitset(...)  ulslice_splitset(__VA_ARGS__)
+  #define slice_strdup(...)    ulslice_strdup(__VA_ARGS__)
+  #define slice_arenadup(...)  ulslice_arenadup(__VA_ARGS__)
+#endif
+
+//===========================================================================
+//                        Length-carrying string slices
+//===========================================================================
+// A ulslice is a pointer and a length into someone else's bytes. It needs no
+// NUL terminator, so substrings are made without copying and nothing here
+// calls strlen() except ulslice_from() and ulslice_eqstr(). Slices do not own
+// their bytes; the underlying buffer must outlive them.
+//
+//     ulslice line = ulslice_make(buf, n), field;
+//     while (ulslice_split(&line, ',', &field)) {
+//         field = ulslice_trim(field);
+//         if (ulslice_eq(field, ulSLICE("GET"))) ...
+//     }
+//
+// Printing: printf("%.*s", (int)s.len, s.ptr)
+
+typedef struct ulslice {
+    const char *ptr;
+    size_t      len;
+} ulslice;
+
+#define ulSLICE(lit)         ((ulslice){ "" lit, sizeof(lit) - 1 })
+
+
+static inline ulslice ulslice_make(const char *p, size_t n) {
+    ulslice s = { p, n };
+    return s;
+}
+
+
+static inline ulslice ulslice_from(const char *str) {
+    return ulslice_make(str, strlen(str));
+}
+
+
+// Bytes [from, to) of s, with both ends clamped to the slice
+static inline ulslice ulslice_sub(ulslice s, size_t from, size_t to) {
+    if (to > s.len) to = s.len;
+    if (from > to) from = to;
+    return ulslice_make(s.ptr + from, to - from);
+}
+
+
+// Trimming
+// --------
+// ulslice_trim() and friends strip ASCII whitespace (" \t\n\v\f\r");
+// ulslice_trimset() strips any member of a byte set from both ends.
+
+static inline int ul__slice_isspace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
+static inline ulslice ulslice_ltrim(ulslice s) {
+    while (s.len && ul__slice_isspace(*s.ptr)) { s.ptr++; s.len--; }
+    return s;
+}
+
+
+static inline ulslice ulslice_rtrim(ulslice s) {
+    while (s.len && ul__slice_isspace(s.ptr[s.len - 1])) s.len--;
+    return s;
+}
+
+
+static inline ulslice ulslice_trim(ulslice s) {
+    return ulslice_rtrim(ulslice_ltrim(s));
+}
+
+
+static inline ulslice ulslice_trimset(ulslice s, const ulbyteset *set) {
+    size_t n = ulbyteset_spann(set, s.ptr, s.len);
+    s.ptr += n;
+    s.len -= n;
+    while (s.len && ulbyteset_has(set, (unsigned char)s.ptr[s.len - 1])) s.len--;
+    return s;
+}
+
+
+// Comparing and Hashing
+// ---------------------
+// ulslice_cmp() orders like strcmp() would on the same bytes, with a proper
+// prefix ordered first. ulhashbytes() is a fast non-cryptographic 64-bit
+// hash that reads eight bytes per step; do not use it against hostile input
+// without a secret seed.
+
+static inline int ulslice_cmp(ulslice a, ulslice b) {
+    size_t n = a.len < b.len ? a.len : b.len;
+    int r = n ? memcmp(a.ptr, b.ptr, n) : 0;
+    if (r) return r;
+    return (a.len > b.len) - (a.len < b.len);
+}
+
+
+static inline int ulslice_eq(ulslice a, ulslice b) {
+    return a.len == b.len && (!a.len || a.ptr == b.ptr || !memcmp(a.ptr, b.ptr, a.len));
+}
+
+
+static inline int ulslice_eqstr(ulslice a, const char *str) {
+    return ulslice_eq(a, ulslice_from(str));
+}
+
+
+static inline int ulslice_startswith(ulslice s, ulslice prefix) {
+    return s.len >= prefix.len &&
+           (!prefix.len || !memcmp(s.ptr, prefix.ptr, prefix.len));
+}
+
+
+static inline int ulslice_endswith(ulslice s, ulslice suffix) {
+    return s.len >= suffix.len &&
+           (!suffix.len || !memcmp(s.ptr + s.len - suffix.len, suffix.ptr, suffix.len));
+}
+
+
+static inline uint64_t ul__hashmix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+// The last n < 8 bytes at p as one little-endian word, without calling
+// memcpy() for a variable length
+static inline uint64_t ul__hashtail(const unsigned char *p, size_t n) {
+    uint64_t w = 0;
+    uint32_t a;
+    uint16_t b;
+    if (n & 4) { memcpy(&a, p, 4); w = a; p += 4; }
+    if (n & 2) { memcpy(&b, p, 2); w |= (uint64_t)b << ((n & 4) * 8); p += 2; }
+    if (n & 1) { w |= (uint64_t)*p << ((n & 6) * 8); }
+    return w;
+}
+
+
+static inline uint64_t ulhashbytes(const void *data, size_t n, uint64_t seed) {
+    const unsigned char *p = data;
+    uint64_t h = seed ^ (n * 0x9E3779B97F4A7C15ULL), w;
+
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ ul__hashmix(w)) * 0x9E3779B97F4A7C15ULL;
+        h = (h << 27) | (h >> 37);
+    }
+    if (n) h ^= ul__hashmix(ul__hashtail(p, n) ^ ((uint64_t)n << 56));
+
+    return ul__hashmix(h);
+}
+
+
+static inline uint64_t ulslice_hash(ulslice s) {
+    return ulhashbytes(s.ptr, s.len, 0);
+}
+
+
+// Searching
+// ---------
+// These mirror strcharfirstptr(), strcharlastptr(), strstrfirstptr(), and
+// strstrlastptr(), returning a pointer into the slice or NULL.
+
+static inline const char *ulslice_charfirstptr(ulslice s, char c) {
+    return s.len ? memchr(s.ptr, c, s.len) : NULL;
+}
+
+
+static inline const char *ulslice_charlastptr(ulslice s, char c) {
+    return ulmemstrlastptr(s.ptr, s.len, &c, 1);
+}
+
+
+static inline const char *ulslice_strfirstptr(ulslice s, ulslice needle) {
+    return ulmemstrfirstptr(s.ptr, s.len, needle.ptr, needle.len);
+}
+
+
+static inline const char *ulslice_strlastptr(ulslice s, ulslice needle) {
+    return ulmemstrlastptr(s.ptr, s.len, needle.ptr, needle.len);
+}
+
+
+// Splitting
+// ---------
+// ulslice_cut() splits s around the first occurrence of sep. If sep is
+// found, it returns 1 with the text on either side in *before and *after;
+// otherwise it returns 0 with *before = s and *after empty.
+//
+// ulslice_split() and ulslice_splitset() take the next field off the front
+// of *rest, up to a delimiter, returning 0 once no fields remain. Adjacent
+// delimiters produce empty fields, as with strsep(). When the last field is
+// taken, rest->ptr becomes NULL; like any empty slice, it can still be
+// compared, searched, or copied.
+
+static inline int ulslice_cut(ulslice s, ulslice sep, ulslice *before, ulslice *after) {
+    const char *p = ulslice_strfirstptr(s, sep);
+
+    if (!p) {
+        *before = s;
+        *after  = ulslice_make(s.ptr + s.len, 0);
+        return 0;
+    }
+    *before = ulslice_make(s.ptr, (size_t)(p - s.ptr));
+    *after  = ulslice_make(p + sep.len, s.len - before->len - sep.len);
+    return 1;
+}
+
+
+static inline int ul__slice_take(ulslice *rest, size_t n, ulslice *field) {
+    *field = ulslice_make(rest->ptr, n);
+    if (n == rest->len) *rest = ulslice_make(NULL, 0);
+    else                *rest = ulslice_make(rest->ptr + n + 1, rest->len - n - 1);
+    return 1;
+}
+
+
+static inline int ulslice_split(ulslice *rest, char delim, ulslice *field) {
+    const char *p;
+    if (!rest->ptr) return 0;
+    p = ulslice_charfirstptr(*rest, delim);
+    return ul__slice_take(rest, p ? (size_t)(p - rest->ptr) : rest->len, field);
+}
+
+
+static inline int ulslice_splitset(ulslice *rest, const ulbyteset *set, ulslice *field) {
+    if (!rest->ptr) return 0;
+    return ul__slice_take(rest, ulbyteset_cspann(set, rest->ptr, rest->len), field);
+}
+
+
+// Copying
+// -------
+// NUL-terminated copies of a slice, on the heap (like ulstrdup) or in an
+// arena (like ularena_strdup).
+
+static inline char *ulslice_strdup(ulslice s) {
+    char *r = malloc(s.len + 1);
+    if (r) { if (s.len) memcpy(r, s.ptr, s.len); r[s.len] = '\0'; }
+    return r;
+}
+
+
+static inline char *ulslice_arenadup(ularena *a, ulslice s) {
+    char *r = ularena_alloc(a, s.len + 1);
+    if (r) { if (s.len) memcpy(r, s.ptr, s.len); r[s.len] = '\0'; }
+    return r;
+}
+
+
+#endif
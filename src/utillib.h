@@ -24,9 +24,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
 #include <limits.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
 
 // ---------------------------------------------------------------------------
 //        Compile-time constants controlling Utility Library behavior
@@ -35,6 +40,11 @@
 // #define ulCROWDEDNAMESPACE
 // #define ulNEEDSTRDUP
 // #define ulNEEDTRACE
+// #define ulTRACEBUF
+// #define ulNOSIMD
+// #define ulASYNCLOG
+// #define ulBINLOG
+// #define ulLOGLEVEL ulLVL_INFO
 #define ulNEEDDBUG
 
 #ifdef NDEBUG
@@ -42,8 +52,86 @@
   #undef  ulNEEDTRACE
 #endif
 
+#ifdef ulBINLOG
+  #undef  ulASYNCLOG
+#endif
+
 #define VOID
 
+#if defined( _MSC_VER )
+  #define ulSHARED __declspec(selectany)
+#else
+  #define ulSHARED __attribute__((weak))
+#endif
+
+#if defined( ulASYNCLOG ) || defined( ulBINLOG ) || defined( ulTRACEBUF )
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/uio.h>
+#endif
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+  #define ulHAVEPOSIX
+  #include <pthread.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+//===========================================================================
+//            Instruction set extensions available for fast paths
+//===========================================================================
+#ifndef ulNOSIMD
+  #if defined( __SSE2__ ) || defined( _M_X64 ) || \
+     (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+    #define ulHAVESSE2
+    #include <emmintrin.h>
+  #endif
+  #if defined( __SSSE3__ )
+    #define ulHAVESSSE3
+    #include <tmmintrin.h>
+  #endif
+  #if defined( __AVX2__ )
+    #define ulHAVEAVX2
+    #include <immintrin.h>
+  #endif
+#endif
+
+// Bit index of the lowest / highest set bit of a nonzero movemask
+static inline int ul__ctz32(uint32_t x) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return __builtin_ctz(x);
+#else
+    int i = 0;
+    while (!(x & 1U)) { x >>= 1; i++; }
+    return i;
+#endif
+}
+
+static inline int ul__msb32(uint32_t x) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return 31 - __builtin_clz(x);
+#else
+    int i = 31;
+    while (!(x & 0x80000000U)) { x <<= 1; i--; }
+    return i;
+#endif
+}
+
+static inline int ul__popcnt32(uint32_t x) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return __builtin_popcount(x);
+#else
+    int i = 0;
+    for (; x; x &= x - 1) i++;
+    return i;
+#endif
+}
+
 //===========================================================================
 //                 Per-compiler pragma string definitions
 //===========================================================================
@@ -72,19 +160,55 @@
 #ifndef ulCROWDEDNAMESPACE
 
   #define LOG(...)             ulLOG(__VA_ARGS__)
+  #define LOGERR(...)          ulLOGERR(__VA_ARGS__)
+  #define LOGWARN(...)         ulLOGWARN(__VA_ARGS__)
+  #define LOGINFO(...)         ulLOGINFO(__VA_ARGS__)
+  #define LOGAT(...)           ulLOGAT(__VA_ARGS__)
+  #define LOGEVERY(...)        ulLOGEVERY(__VA_ARGS__)
+  #define LOGRATE(...)         ulLOGRATE(__VA_ARGS__)
   #define DBUG(...)            ulDBUG(__VA_ARGS__)
   #define VARDBUG(...)         ulVARDBUG(__VA_ARGS__)
+  #define HEXDBUG(...)         ulHEXDBUG(__VA_ARGS__)
+  #define CDPTDBUG(...)        ulCDPTDBUG(__VA_ARGS__)
 
   #define BEGIN_FUNCTION       ulBEGIN_FUNCTION
   #define RETURN(x)            ulRETURN(x)
   #define FAIL(x,...)          ulFAIL(x,__VA_ARGS__)
   #define DIE(...)             ulDIE(__VA_ARGS__)
 
+  #define fmt_init(...)        ulfmt_init(__VA_ARGS__)
+  #define fmt_len(...)         ulfmt_len(__VA_ARGS__)
+  #define fmt_mem(...)         ulfmt_mem(__VA_ARGS__)
+  #define fmt_chr(...)         ulfmt_chr(__VA_ARGS__)
+  #define fmt_str(...)         ulfmt_str(__VA_ARGS__)
+  #define fmt_int(...)         ulfmt_int(__VA_ARGS__)
+  #define fmt_uint(...)        ulfmt_uint(__VA_ARGS__)
+  #define fmt_double(...)      ulfmt_double(__VA_ARGS__)
+  #define fmt_ptr(...)         ulfmt_ptr(__VA_ARGS__)
+  #define fmt_hex(...)         ulfmt_hex(__VA_ARGS__)
+  #define fmt_cdpt(...)        ulfmt_cdpt(__VA_ARGS__)
+
   #define free(...)            ulfree(__VA_ARGS__)
   #define memzero(...)         ulmemzero(__VA_ARGS__)
   #define memzerosecure(...)   ulmemzerosecure(__VA_ARGS__)
 
+  #define arena_create(...)    ularena_create(__VA_ARGS__)
+  #define arena_destroy(...)   ularena_destroy(__VA_ARGS__)
+  #define arena_alloc(...)     ularena_alloc(__VA_ARGS__)
+  #define arena_strdup(...)    ularena_strdup(__VA_ARGS__)
+  #define arena_adopt(...)     ularena_adopt(__VA_ARGS__)
+  #define arena_mark(...)      ularena_mark(__VA_ARGS__)
+  #define arena_rewind(...)    ularena_rewind(__VA_ARGS__)
+  #define arena_reset(...)     ularena_reset(__VA_ARGS__)
+  #define tmp_begin(...)       ultmp_begin(__VA_ARGS__)
+  #define tmp_end(...)         ultmp_end(__VA_ARGS__)
+
   #define inputline(...)       ulinputline(__VA_ARGS__)
+  #define linereader_fd(...)   ullinereader_fd(__VA_ARGS__)
+  #define linereader_file(...) ullinereader_file(__VA_ARGS__)
+  #define linereader_open(...) ullinereader_open(__VA_ARGS__)
+  #define linereader_next(...) ullinereader_next(__VA_ARGS__)
+  #define linereader_close(...) ullinereader_close(__VA_ARGS__)
   #define autostr(...)         ulautostr(__VA_ARGS__)
   #define S(...)               ulautostr(__VA_ARGS__)
 
@@ -94,15 +218,48 @@
   #define strcharlastptr(...)  ulstrcharlastptr(__VA_ARGS__)
   #define strstrfirstptr(...)  ulstrstrfirstptr(__VA_ARGS__)
   #define strstrlastptr(...)   ulstrstrlastptr(__VA_ARGS__)
+  #define memstrfirstptr(...)  ulmemstrfirstptr(__VA_ARGS__)
+  #define memstrlastptr(...)   ulmemstrlastptr(__VA_ARGS__)
+  #define strsearch_init(...)  ulstrsearch_init(__VA_ARGS__)
+  #define strsearch_first(...) ulstrsearch_first(__VA_ARGS__)
+  #define strsearch_last(...)  ulstrsearch_last(__VA_ARGS__)
+  #define BYTESET(...)         ulBYTESET(__VA_ARGS__)
+  #define byteset_init(...)    ulbyteset_init(__VA_ARGS__)
+  #define byteset_initn(...)   ulbyteset_initn(__VA_ARGS__)
+  #define byteset_has(...)     ulbyteset_has(__VA_ARGS__)
+  #define byteset_span(...)    ulbyteset_span(__VA_ARGS__)
+  #define byteset_cspan(...)   ulbyteset_cspan(__VA_ARGS__)
+  #define byteset_spann(...)   ulbyteset_spann(__VA_ARGS__)
+  #define byteset_cspann(...)  ulbyteset_cspann(__VA_ARGS__)
+  #define byteset_first(...)   ulbyteset_first(__VA_ARGS__)
+  #define byteset_firstn(...)  ulbyteset_firstn(__VA_ARGS__)
+  #define byteset_last(...)    ulbyteset_last(__VA_ARGS__)
+  #define byteset_lastn(...)   ulbyteset_lastn(__VA_ARGS__)
+  #define bytesplit_init(...)  ulbytesplit_init(__VA_ARGS__)
+  #define bytesplit_next(...)  ulbytesplit_next(__VA_ARGS__)
   
   #ifdef ulNEED_STRDUP
   #define strdup(...)          ulstrdup(__VA_ARGS__)
   #endif
 
   #define cdpt_from_utf8(s)          ulcdpt_from_utf8(s)
+  #define cdpts_from_utf8(...)       ulcdpts_from_utf8(__VA_ARGS__)
+  #define utf16_from_utf8_chunk(...) ulutf16_from_utf8_chunk(__VA_ARGS__)
+  #define utf8_from_utf16_chunk(...) ulutf8_from_utf16_chunk(__VA_ARGS__)
+  #define utf16_from_utf8_flush(...) ulutf16_from_utf8_flush(__VA_ARGS__)
+  #define utf8_from_utf16_flush(...) ulutf8_from_utf16_flush(__VA_ARGS__)
   #define cdpt_from_utf16(h, l)      ulcdpt_from_utf16(h, l)
   #define utf16_from_cdpt(c, h, l)   ulutf16_from_cdpt(c, h, l)
   #define utf8_from_cdpt(c)          ulutf8_from_cdpt(c)
+  #define utf8_from_cdpt_r(...)      ulutf8_from_cdpt_r(__VA_ARGS__)
+  #define utf8_from_cdpts(...)       ulutf8_from_cdpts(__VA_ARGS__)
+  #define utf8_size_from_cdpts(...)  ulutf8_size_from_cdpts(__VA_ARGS__)
+  #define utf8_validate(...)         ulutf8_validate(__VA_ARGS__)
+  #define utf8_count(...)            ulutf8_count(__VA_ARGS__)
+  #define utf8_offset(...)           ulutf8_offset(__VA_ARGS__)
+  #define utf8index_create(...)      ulutf8index_create(__VA_ARGS__)
+  #define utf8index_offset(...)      ulutf8index_offset(__VA_ARGS__)
+  #define utf8index_destroy(...)     ulutf8index_destroy(__VA_ARGS__)
 
 #endif
 
@@ -119,263 +276,3425 @@
 //                    Logging and debugging functionality
 //===========================================================================
 
-#define ulLOG(...) (\
-    fprintf(stderr, "In %s:%s() line %d: ", __FILE__, __func__, __LINE__)  &&\
-    fprintf(stderr, __VA_ARGS__)                                           &&\
-    fprintf(stderr, "\n")\
-    )
-
-#ifndef ulNEEDDBUG
-#define ulDBUG(...) ((void)0)
-#else
-#define ulDBUG(...) (ulLOG(__VA_ARGS__))
+// Typed formatting
+// ----------------
+// A ulfmtbuf appends text to a caller-supplied buffer, usually on the stack,
+// with no allocation, no locale, and no format string to parse at run time.
+// Each writer handles one type: ulfmt_int/ulfmt_uint emit two digits per
+// division, ulfmt_double writes six decimals directly below 1e15 and defers
+// to snprintf("%f") above it and near rounding ties, ulfmt_ptr writes
+// 0x-prefixed hex, ulfmt_hex dumps bytes as space-separated hex pairs, and
+// ulfmt_cdpt writes U+XXXX and the character itself. ulfmt(b, x) selects the writer from the type of x.
+// Output that does not fit is dropped; ulfmt_len() reports what was kept.
+// The default ulLOG backend and ulVARDBUG build each record this way and
+// emit it with one write().
+
+#ifndef ulLOGLINEMAX
+#define ulLOGLINEMAX     512
 #endif
 
-#ifndef ulNEEDDBUG
-#define ulVARDBUG(x)   ((void)0)
-#else
-#define ulVARDBUG(x)                                                                                                                     \
-                    _Pragma(PRAGMADIAGPUSH)                                                                                              \
-                    _Pragma(PRAGMADIAGFORMAT)                                                                                            \
-                    _Generic((x),                                                                                                        \
-              char: fprintf(stderr,"%s:%d %s=%c\n",   __FILE__, __LINE__, #x, x ),                                                       \
-       signed char: fprintf(stderr,"%s:%d %s=%c\n",   __FILE__, __LINE__, #x, x ),                                                       \
-     unsigned char: fprintf(stderr,"%s:%d %s=%c\n",   __FILE__, __LINE__, #x, x ),                                                       \
-               int: fprintf(stderr,"%s:%d %s=%d\n",   __FILE__, __LINE__, #x, x ),                                                       \
-      unsigned int: fprintf(stderr,"%s:%d %s=%u\n",   __FILE__, __LINE__, #x, x ),                                                       \
-              long: fprintf(stderr,"%s:%d %s=%ld\n",  __FILE__, __LINE__, #x, x ),                                                       \
-         long long: fprintf(stderr,"%s:%d %s=%lld\n", __FILE__, __LINE__, #x, x ),                                                       \
-     unsigned long: fprintf(stderr,"%s:%d %s=%lu\n",  __FILE__, __LINE__, #x, x ),                                                       \
-unsigned long long: fprintf(stderr,"%s:%d %s=%llu\n", __FILE__, __LINE__, #x, x ),                                                       \
-             float: fprintf(stderr,"%s:%d %s=%f\n",   __FILE__, __LINE__, #x, x ),                                                       \
-            double: fprintf(stderr,"%s:%d %s=%f\n",   __FILE__, __LINE__, #x, x ),                                                       \
-       long double: fprintf(stderr,"%s:%d %s=%f\n",   __FILE__, __LINE__, #x, x ),                                                       \
-             _Bool: fprintf(stderr,"%s:%d %s=%s\n",                               __FILE__, __LINE__, #x, (x)?"true":"false"),           \
-             char*: fprintf(stderr,(x)?"%s:%d %s=\"%s\"\n":"%s:%d %s=NULL\n",     __FILE__, __LINE__, #x                    ),           \
-      signed char*: fprintf(stderr,(x)?"%s:%d %s=\"%s\"\n":"%s:%d %s=NULL\n",     __FILE__, __LINE__, #x                    ),           \
-    unsigned char*: fprintf(stderr,(x)?"%s:%d %s=\"%s\"\n":"%s:%d %s=NULL\n",     __FILE__, __LINE__, #x                    ),           \
-           default: fprintf(stderr,"%s:%d first byte of %s (unk type) is 0x%x\n", __FILE__, __LINE__, #x, (int)(*((unsigned char *)&x))) \
-                    _Pragma(PRAGMADIAGPOP)
+typedef struct ulfmtbuf {
+    char  *base;
+    char  *p;                          // Next byte to write
+    char  *end;                        // One past the last usable byte
+} ulfmtbuf;
 
-#endif
+static inline int ul__utf8_encode1(int32_t c, unsigned char *d);
 
-#define ulDIE(...) (\
-    fprintf(stderr, "DIED: %s:%s() line %d: ",__FILE__,__func__,__LINE__)  &&\
-    fprintf(stderr, __VA_ARGS__)                                           &&\
-    fprintf(stderr, "\n\n\n")                                              &&\
-    (exit(EXIT_FAILURE), 1)\
-    )
+static inline void ulfmt_init(ulfmtbuf *b, char *buf, size_t n) {
+    b->base = b->p = buf;
+    b->end  = buf + n;
+}
 
+static inline size_t ulfmt_len(const ulfmtbuf *b) {
+    return (size_t)(b->p - b->base);
+}
 
+static inline void ulfmt_mem(ulfmtbuf *b, const void *s, size_t n) {
+    size_t room = (size_t)(b->end - b->p);
+    if (n > room) n = room;
+    if (n) memcpy(b->p, s, n);
+    b->p += n;
+}
 
+static inline void ulfmt_chr(ulfmtbuf *b, char c) {
+    if (b->p < b->end) *b->p++ = c;
+}
 
-#ifdef ulNEEDTRACE
-static inline void ultrace(int x, const char *funcname) {
-    static _Thread_local int spaces = 0;
-    if (x > 0) {
-        fprintf(stderr,"%*cEntering %s()\n", spaces, ' ', funcname);
-        spaces+=4;
-    } else {
-        if (spaces >= 4) spaces-=4;
-        fprintf(stderr,"%*cExiting %s()\n",  spaces, ' ', funcname);
+static inline void ulfmt_str(ulfmtbuf *b, const char *s) {
+    if (s) ulfmt_mem(b, s, strlen(s));
+    else   ulfmt_mem(b, "NULL", 4);
+}
+
+static inline void ulfmt_uint(ulfmtbuf *b, unsigned long long v) {
+    static const char pairs[] =
+        "00010203040506070809" "10111213141516171819" "20212223242526272829"
+        "30313233343536373839" "40414243444546474849" "50515253545556575859"
+        "60616263646566676869" "70717273747576777879" "80818283848586878889"
+        "90919293949596979899";
+    char t[20], *q = t + sizeof t;
+
+    while (v >= 100) {
+        q -= 2;
+        memcpy(q, pairs + 2 * (v % 100), 2);
+        v /= 100;
     }
+    if (v >= 10) { q -= 2; memcpy(q, pairs + 2 * v, 2); }
+    else         { *--q = (char)('0' + v); }
+    ulfmt_mem(b, q, (size_t)(t + sizeof t - q));
 }
-#define ulTRACE(x)       ultrace(x, __func__)
+
+static inline void ulfmt_int(ulfmtbuf *b, long long v) {
+    if (v < 0) ulfmt_chr(b, '-');
+    ulfmt_uint(b, v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v);
+}
+
+// Matches printf("%f"). Below 1e15 the six decimals come from the product
+// of the fraction and 1e6, whose rounding can move a value that is not a tie
+// onto .5 or across it, so anything within 1e-9 of a tie (the product's error
+// is under 6e-11) is left to snprintf, as are values from 1e15 up.
+static inline void ulfmt_double(ulfmtbuf *b, double v) {
+    char t[320];
+    int n;
+
+    if (v != v) { ulfmt_mem(b, "nan", 3); return; }
+    if (v < 0 || (v == 0 && 1 / v < 0)) { ulfmt_chr(b, '-'); v = -v; }
+    if (v - v != 0) { ulfmt_mem(b, "inf", 3); return; }
+
+    if (v < 1e15) {
+        unsigned long long ip = (unsigned long long)v;
+        double x = (v - (double)ip) * 1e6;   // The subtraction is exact
+        unsigned f = (unsigned)x;
+        double r = x - f;                    // So is this one
+        if (r < 0.5 - 1e-9 || r > 0.5 + 1e-9) {
+            if (r > 0.5 && ++f == 1000000) { ip++; f = 0; }
+            t[0] = '.';
+            for (int i = 6; i > 0; i--) { t[i] = (char)('0' + f % 10); f /= 10; }
+            ulfmt_uint(b, ip);
+            ulfmt_mem(b, t, 7);
+            return;
+        }
+    }
+
+    n = snprintf(t, sizeof t, "%f", v);
+    if (n > 0) ulfmt_mem(b, t, (size_t)n < sizeof t ? (size_t)n : sizeof t - 1);
+}
+
+static inline void ulfmt_ptr(ulfmtbuf *b, const void *p) {
+    uintptr_t v = (uintptr_t)p;
+    char t[2 + 2 * sizeof v], *q = t + sizeof t;
+
+    if (!p) { ulfmt_mem(b, "NULL", 4); return; }
+    do { *--q = "0123456789abcdef"[v & 15]; } while (v >>= 4);
+    *--q = 'x';
+    *--q = '0';
+    ulfmt_mem(b, q, (size_t)(t + sizeof t - q));
+}
+
+static inline void ulfmt_hex(ulfmtbuf *b, const void *p, size_t n) {
+    const unsigned char *s = p;
+    for (size_t i = 0; i < n && b->p < b->end; i++) {
+        char t[3] = { ' ', "0123456789abcdef"[s[i] >> 4], "0123456789abcdef"[s[i] & 15] };
+        ulfmt_mem(b, t + (i == 0), 3 - (i == 0));
+    }
+}
+
+static inline void ulfmt_cdpt(ulfmtbuf *b, int32_t c) {
+    char t[16];
+    int n = 4;
+
+    if (c < 0 || c > 0x10FFFF) {
+        ulfmt_int(b, c);
+        ulfmt_mem(b, " (invalid)", 10);
+        return;
+    }
+    while (n < 6 && c >> (4 * n)) n++;
+    t[0] = 'U';
+    t[1] = '+';
+    for (int i = 0; i < n; i++) t[2 + i] = "0123456789ABCDEF"[c >> (4 * (n - 1 - i)) & 15];
+    n += 2;
+
+    if (0xD800 <= c && c <= 0xDFFF) {
+        ulfmt_mem(b, t, (size_t)n);
+        ulfmt_mem(b, " (surrogate)", 12);
+        return;
+    }
+    if (c >= 0x20 && c != 0x7F && !(0x80 <= c && c < 0xA0)) {   // Printable
+        t[n++] = ' ';
+        t[n++] = '\'';
+        n += ul__utf8_encode1(c, (unsigned char *)t + n);
+        t[n++] = '\'';
+    }
+    ulfmt_mem(b, t, (size_t)n);
+}
+
+static inline void ul__fmt_bool(ulfmtbuf *b, _Bool v) {
+    if (v) ulfmt_mem(b, "true", 4);
+    else   ulfmt_mem(b, "false", 5);
+}
+
+#define ulfmt(b, x) _Generic((x),                                             \
+             _Bool: ul__fmt_bool,                                              \
+              char: ulfmt_chr,                                                 \
+       signed char: ulfmt_int,                                                 \
+             short: ulfmt_int,                                                 \
+               int: ulfmt_int,                                                 \
+              long: ulfmt_int,                                                 \
+         long long: ulfmt_int,                                                 \
+     unsigned char: ulfmt_uint,                                                \
+    unsigned short: ulfmt_uint,                                                \
+      unsigned int: ulfmt_uint,                                                \
+     unsigned long: ulfmt_uint,                                                \
+unsigned long long: ulfmt_uint,                                                \
+             float: ulfmt_double,                                              \
+            double: ulfmt_double,                                              \
+       long double: ulfmt_double,                                              \
+            char *: ulfmt_str,                                                 \
+      const char *: ulfmt_str,                                                 \
+           default: ulfmt_ptr)((b), (x))
+
+// Writes all of s to stderr with as few system calls as it takes
+static inline void ul__fmt_stderr(const char *s, size_t n) {
+#ifdef ulHAVEPOSIX
+    while (n > 0) {
+        ssize_t w = write(STDERR_FILENO, s, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        s += w;
+        n -= (size_t)w;
+    }
 #else
-#define ulTRACE(x)       ((void)0)
+    fwrite(s, 1, n, stderr);
 #endif
+}
 
-#define ulBEGIN_FUNCTION ulTRACE(1);
-#define ulRETURN(x)      do { ulTRACE(0);         return x;    } while(0)
-#define ulFAIL(x,...)    do { ulLOG(__VA_ARGS__); ulRETURN(x); } while(0)
+#if defined( ulBINLOG )
+
+// Deferred binary logging (POSIX, GCC/Clang)
+// ------------------------------------------
+// With ulBINLOG defined, ulLOG/ulDBUG do no printf formatting at all. Each
+// call site owns a static descriptor with its file, function, and line. On
+// first use the site is assigned an ID and its format string is parsed once
+// into a list of argument types. Since later calls reuse that list, the
+// format must be a string literal; ulLOG pastes "" in front of it, so a
+// variable or a conditional expression is a compile-time error here rather
+// than arguments read as the wrong types. Every call after that appends only the site
+// ID, a CLOCK_REALTIME timestamp, and the raw argument bytes (string
+// contents for %s, up to the precision if one is given) to a per-thread
+// buffer. A full buffer is appended to the
+// log file with one write(); so is each thread's buffer when it exits, and
+// every buffer at process exit. Each buffer has its own mutex, taken by its
+// thread while appending and by whoever flushes it, so a flush at exit or in
+// ulDIE never races a record being written. Records logged after the exit
+// flush are lost. The file is $ULBINLOG, or ulBINLOGPATH if unset; render
+// it with tools/ulbinlogdump.c. ulDIE flushes every buffer, then prints its
+// message to stderr as text.
+//
+// Log format (native byte order and type sizes):
+//   chunk:  "ULB1"  u32 chunk bytes  u64 thread number  records...
+//   site:   'S'  u32 id  u32 line  u16 file/func/fmt lengths  the strings
+//   event:  'E'  u32 id  u64 ns  u32 arg bytes  args...
+
+#ifndef ulBINLOGPATH
+#define ulBINLOGPATH     "ulbinlog.out"
+#endif
+#ifndef ulBINLOGBUFSZ
+#define ulBINLOGBUFSZ    65536
+#endif
+#define ulBINLOGMAXARGS  16
+#define ulBINLOGSTRMAX   2048          // Longest %s argument recorded
+#define ulBINLOGCHUNKHDR 16
+
+enum { ulBL_INT, ulBL_LONG, ulBL_LLONG, ulBL_INTMAX, ulBL_SIZE, ulBL_PTRDIFF,
+       ulBL_DOUBLE, ulBL_LDOUBLE, ulBL_STR, ulBL_PTR };
+
+#define ul__BLPREC_NONE  (-1)          // %s reads up to the NUL
+#define ul__BLPREC_STAR  (-2)          // %.*s takes the preceding int
+
+typedef struct ul__blogsite {
+    const char       *file;
+    const char       *func;
+    int               line;
+    const char       *fmt;
+    _Atomic uint32_t  id;
+    int               nargs;
+    unsigned char     type[ulBINLOGMAXARGS];
+    int               prec[ulBINLOGMAXARGS];   // For ulBL_STR arguments
+} ul__blogsite;
+
+typedef struct ul__blogbuf {
+    struct ul__blogbuf *next;
+    pthread_mutex_t     lock;          // Taken after ul__blog_state.lock
+    uint64_t            tid;
+    size_t              len;
+    unsigned char       data[ulBINLOGBUFSZ];
+} ul__blogbuf;
+
+typedef struct ul__blogstate {
+    pthread_mutex_t     lock;
+    pthread_once_t      once;
+    pthread_key_t       key;
+    int                 fd;
+    uint32_t            nsites;
+    uint64_t            nthreads;
+    ul__blogbuf        *bufs;
+} ul__blogstate;
+
+ulSHARED ul__blogstate ul__blog_state = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT, 0, -1, 0, 0, NULL
+};
+ulSHARED _Thread_local ul__blogbuf *ul__blog_tbuf;
+
+
+static inline size_t ul__blog_typesize(int t) {
+    switch (t) {
+        case ulBL_INT:      return sizeof(int);
+        case ulBL_LONG:     return sizeof(long);
+        case ulBL_LLONG:    return sizeof(long long);
+        case ulBL_INTMAX:   return sizeof(intmax_t);
+        case ulBL_SIZE:     return sizeof(size_t);
+        case ulBL_PTRDIFF:  return sizeof(ptrdiff_t);
+        case ulBL_DOUBLE:   return sizeof(double);
+        case ulBL_LDOUBLE:  return sizeof(long double);
+        case ulBL_STR:      return sizeof(uint32_t);       // Plus contents
+        default:            return sizeof(void *);
+    }
+}
+
+
+// Parse the conversion spec at p (which points at '%'), appending the types
+// of the arguments it consumes to t[*nt], and for a string its precision to
+// prec[*nt]. Returns the first byte past it. Shared with the decoder so both
+// sides agree on the argument layout.
+static inline const char *ul__blog_spec(const char *p, unsigned char *t,
+                                        int *prec, int *nt) {
+    int len = 0, ty, pr = ul__BLPREC_NONE;
 
+    #define ul__BLOGADD(x) do { if (*nt < ulBINLOGMAXARGS) t[(*nt)++] = (unsigned char)(x); } while (0)
 
+    p++;
+    if (*p == '%') return p + 1;
 
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') { ul__BLOGADD(ulBL_INT); p++; }
+    else while ('0' <= *p && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') { ul__BLOGADD(ulBL_INT); p++; pr = ul__BLPREC_STAR; }
+        else for (pr = 0; '0' <= *p && *p <= '9'; p++) {
+            if (pr < ulBINLOGSTRMAX) pr = pr * 10 + (*p - '0');
+        }
+    }
 
+    for (;; p++) {
+        if      (*p == 'h') continue;
+        else if (*p == 'l') len = (len == 'l') ? 'q' : 'l';
+        else if (*p == 'q' || *p == 'L' || *p == 'j' || *p == 'z' || *p == 't')
+            len = *p;
+        else break;
+    }
 
+    switch (*p) {
+        case '\0':
+            return p;
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            ty = len == 'l' && *p != 'c' ? ulBL_LONG    :
+                 len == 'q' || len == 'L' ? ulBL_LLONG  :
+                 len == 'j'               ? ulBL_INTMAX :
+                 len == 'z'               ? ulBL_SIZE   :
+                 len == 't'               ? ulBL_PTRDIFF: ulBL_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            ty = len == 'L' ? ulBL_LDOUBLE : ulBL_DOUBLE;
+            break;
+        case 's':
+            ty = len == 'l' ? ulBL_PTR : ulBL_STR;
+            if (*nt < ulBINLOGMAXARGS) prec[*nt] = pr;
+            break;
+        case 'p': case 'n':
+            ty = ulBL_PTR;
+            break;
+        default:
+            return p + 1;
+    }
+    ul__BLOGADD(ty);
 
+    #undef ul__BLOGADD
+    return p + 1;
+}
 
 
+// Bytes of a %s argument to record: never past its precision, its NUL, or
+// ulBINLOGSTRMAX. A negative * precision counts as none, as in printf.
+static inline size_t ul__blog_strlen(const char *s, int prec, int star) {
+    if (prec == ul__BLPREC_STAR) prec = star;
+    if (prec < 0 || prec > ulBINLOGSTRMAX) prec = ulBINLOGSTRMAX;
+    const char *z = memchr(s, '\0', (size_t)prec);
+    return z ? (size_t)(z - s) : (size_t)prec;
+}
 
 
+static inline void ul__blog_put(ul__blogbuf *b, const void *v, size_t n) {
+    memcpy(b->data + b->len, v, n);
+    b->len += n;
+}
 
 
-//===========================================================================
-//                            Memory functionality
-//===========================================================================
-#define ulfree(x)        do { (free)(x); x = NULL; } while (0)
-#define ulmemzero(x, y)  memset(x, 0, y)
+static inline void ul__blog_flushbuf(ul__blogbuf *b) {
+    uint32_t n = (uint32_t)b->len;
+    if (b->len <= ulBINLOGCHUNKHDR) return;
+    memcpy(b->data,     "ULB1", 4);
+    memcpy(b->data + 4, &n, 4);
+    memcpy(b->data + 8, &b->tid, 8);
+    if (ul__blog_state.fd >= 0 && write(ul__blog_state.fd, b->data, b->len) < 0) {
+        // Nowhere left to report a failed log write
+    }
+    b->len = ulBINLOGCHUNKHDR;
+}
 
-static inline void ulmemzerosecure(void *const p, const size_t z) {
-    volatile unsigned char *volatile p_ = (volatile unsigned char *volatile)p;
-    for (size_t i=(size_t)0U; i<z; i++) {
-        p_[i] = 0U;
+
+static inline void ul__blog_flushall(void) {
+    pthread_mutex_lock(&ul__blog_state.lock);
+    for (ul__blogbuf *b = ul__blog_state.bufs; b; b = b->next) {
+        pthread_mutex_lock(&b->lock);
+        ul__blog_flushbuf(b);
+        pthread_mutex_unlock(&b->lock);
     }
+    pthread_mutex_unlock(&ul__blog_state.lock);
 }
 
 
+static inline void ul__blog_threadexit(void *arg) {
+    ul__blogbuf *b = arg, **pp;
+    pthread_mutex_lock(&ul__blog_state.lock);
+    pthread_mutex_lock(&b->lock);
+    ul__blog_flushbuf(b);
+    pthread_mutex_unlock(&b->lock);
+    for (pp = &ul__blog_state.bufs; *pp; pp = &(*pp)->next) {
+        if (*pp == b) { *pp = b->next; break; }
+    }
+    pthread_mutex_unlock(&ul__blog_state.lock);
+    pthread_mutex_destroy(&b->lock);
+    (free)(b);
+}
 
 
+static inline void ul__blog_init(void) {
+    const char *path = getenv("ULBINLOG");
+    ul__blog_state.fd = open(path ? path : ulBINLOGPATH,
+                             O_WRONLY | O_CREAT | O_APPEND, 0644);
+    pthread_key_create(&ul__blog_state.key, ul__blog_threadexit);
+    atexit(ul__blog_flushall);
+}
 
 
+static inline ul__blogbuf *ul__blog_thread(void) {
+    ul__blogbuf *b;
 
+    pthread_once(&ul__blog_state.once, ul__blog_init);
+    if ((b = malloc(sizeof *b)) == NULL) return NULL;
+    b->len = ulBINLOGCHUNKHDR;
+    pthread_mutex_init(&b->lock, NULL);
 
+    pthread_mutex_lock(&ul__blog_state.lock);
+    b->tid  = ++ul__blog_state.nthreads;
+    b->next = ul__blog_state.bufs;
+    ul__blog_state.bufs = b;
+    pthread_mutex_unlock(&ul__blog_state.lock);
 
+    pthread_setspecific(ul__blog_state.key, b);
+    return ul__blog_tbuf = b;
+}
 
-//===========================================================================
-//                              String functions
-//===========================================================================
-#define ul__stridxnomatch(...)       strspn(__VA_ARGS__)
-#define ul__stridxmatch(...)         strcspn(__VA_ARGS__)
-#define ul__strcharfirstptr(...)     strchr(__VA_ARGS__)
-#define ul__strcharlastptr(...)      strrchr(__VA_ARGS__)
-#define ul__strstrfirstptr(...)      strstr(__VA_ARGS__)
-#define ul__strstrlastptr(...)       strrstr(__VA_ARGS__)
 
+static inline uint32_t ul__blog_register(ul__blogsite *site, const char *fmt,
+                                         ul__blogbuf *b) {
+    uint32_t id;
 
+    pthread_mutex_lock(&ul__blog_state.lock);
+    if ((id = atomic_load_explicit(&site->id, memory_order_relaxed)) == 0) {
+        size_t   fl = strlen(site->file), fn = strlen(site->func), fm = strlen(fmt);
+        uint32_t ln = (uint32_t)site->line;
+        uint16_t z;
 
-// Wrap fgets() for standard human input
-// -------------------------------------
-static inline char *ulinputline(char *buf, int n, FILE *fp) {
-    if (fgets(buf, n, fp) == NULL) return NULL;
-    
-    if (strlen(buf) < 1) return buf;     // Go ahead and return empty string
+        if (fl > 4096) fl = 4096;
+        if (fn > 4096) fn = 4096;
+        if (fm > 32768) fm = 32768;
 
-    if (buf[strlen(buf)-1] == '\n') {    // If we got the newline, NUL it
-        buf[strlen(buf)-1] = '\0';
-    } else {                             // If we didn't get the newline
-        scanf("%*[^\n]");                //   Read everything UP TO newline
-        scanf("%*c");                    //   And then one more byte
+        site->fmt = fmt;
+        site->nargs = 0;
+        for (const char *p = fmt; *p; ) {
+            p = (*p == '%') ? ul__blog_spec(p, site->type, site->prec, &site->nargs) : p + 1;
+        }
+        id = ++ul__blog_state.nsites;
+
+        pthread_mutex_lock(&b->lock);
+        if (b->len + 15 + fl + fn + fm > ulBINLOGBUFSZ) ul__blog_flushbuf(b);
+        ul__blog_put(b, "S", 1);
+        ul__blog_put(b, &id, 4);
+        ul__blog_put(b, &ln, 4);
+        z = (uint16_t)fl; ul__blog_put(b, &z, 2);
+        z = (uint16_t)fn; ul__blog_put(b, &z, 2);
+        z = (uint16_t)fm; ul__blog_put(b, &z, 2);
+        ul__blog_put(b, site->file, fl);
+        ul__blog_put(b, site->func, fn);
+        ul__blog_put(b, fmt, fm);
+        pthread_mutex_unlock(&b->lock);
+
+        atomic_store_explicit(&site->id, id, memory_order_release);
     }
+    pthread_mutex_unlock(&ul__blog_state.lock);
 
-    return buf;
+    return id;
 }
 
 
+static inline int ul__blog(ul__blogsite *site, const char *fmt, ...) {
+    ul__blogbuf *b = ul__blog_tbuf ? ul__blog_tbuf : ul__blog_thread();
+    uint32_t id, argz = 0;
+    int star = -1;
+    struct timespec ts;
+    uint64_t ns;
+    va_list ap;
 
-// Allow quick/dirty auto storage of dynamic strings
-// -------------------------------------------------
-static inline char *ulautostr(char *s) {
-    _Thread_local static char buffer[16384];
-    if (!s) return NULL;
-    size_t len = (16383 < strlen(s)) ? 16383 : strlen(s);
-    memmove(buffer, s, len);
-    buffer[len] = '\0';
-    free(s);
-    return buffer;
+    if (!b) return 0;
+    if ((id = atomic_load_explicit(&site->id, memory_order_acquire)) == 0) {
+        id = ul__blog_register(site, fmt, b);
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+
+    // Size the record first so it is never split across chunks
+    va_start(ap, fmt);
+    for (int i = 0; i < site->nargs; i++) {
+        argz += (uint32_t)ul__blog_typesize(site->type[i]);
+        if (site->type[i] == ulBL_STR) {
+            const char *str = va_arg(ap, const char *);
+            argz += (uint32_t)ul__blog_strlen(str ? str : "(null)", site->prec[i], star);
+        }
+        else switch (site->type[i]) {
+            case ulBL_INT:      star = va_arg(ap, int);         break;
+            case ulBL_LONG:     (void)va_arg(ap, long);         break;
+            case ulBL_LLONG:    (void)va_arg(ap, long long);    break;
+            case ulBL_INTMAX:   (void)va_arg(ap, intmax_t);     break;
+            case ulBL_SIZE:     (void)va_arg(ap, size_t);       break;
+            case ulBL_PTRDIFF:  (void)va_arg(ap, ptrdiff_t);    break;
+            case ulBL_DOUBLE:   (void)va_arg(ap, double);       break;
+            case ulBL_LDOUBLE:  (void)va_arg(ap, long double);  break;
+            default:            (void)va_arg(ap, void *);       break;
+        }
+    }
+    va_end(ap);
+
+    pthread_mutex_lock(&b->lock);
+    if (b->len + 17 + argz > ulBINLOGBUFSZ) ul__blog_flushbuf(b);
+    ul__blog_put(b, "E", 1);
+    ul__blog_put(b, &id, 4);
+    ul__blog_put(b, &ns, 8);
+    ul__blog_put(b, &argz, 4);
+
+    va_start(ap, fmt);
+    for (int i = 0; i < site->nargs; i++) {
+        switch (site->type[i]) {
+            case ulBL_INT:     { int         v = va_arg(ap, int);         ul__blog_put(b, &v, sizeof v); star = v; break; }
+            case ulBL_LONG:    { long        v = va_arg(ap, long);        ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_LLONG:   { long long   v = va_arg(ap, long long);   ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_INTMAX:  { intmax_t    v = va_arg(ap, intmax_t);    ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_SIZE:    { size_t      v = va_arg(ap, size_t);      ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_PTRDIFF: { ptrdiff_t   v = va_arg(ap, ptrdiff_t);   ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_DOUBLE:  { double      v = va_arg(ap, double);      ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_LDOUBLE: { long double v = va_arg(ap, long double); ul__blog_put(b, &v, sizeof v); break; }
+            case ulBL_STR: {
+                const char *str = va_arg(ap, const char *);
+                if (!str) str = "(null)";
+                uint32_t z = (uint32_t)ul__blog_strlen(str, site->prec[i], star);
+                ul__blog_put(b, &z, 4);
+                ul__blog_put(b, str, z);
+                break;
+            }
+            default:           { void       *v = va_arg(ap, void *);      ul__blog_put(b, &v, sizeof v); break; }
+        }
+    }
+    va_end(ap);
+    pthread_mutex_unlock(&b->lock);
+
+    return 1;
+}
+
+#define ulLOG(...) (__extension__({                                            \
+    static ul__blogsite ul__site = { .file = __FILE__, .func = __func__,      \
+                                     .line = __LINE__ };                      \
+    ul__blog(&ul__site, "" __VA_ARGS__);                                      \
+    }))
+
+#elif defined( ulASYNCLOG )
+
+// Asynchronous logging backend (POSIX only)
+// -----------------------------------------
+// With ulASYNCLOG defined, ulLOG/ulDBUG/ulDIE format each whole line into a
+// per-thread buffer and push it onto a bounded lock-free MPSC ring (Vyukov's
+// sequence-numbered queue). A background thread, started on first use,
+// drains consecutive ready slots with one writev() per batch, so lines from
+// different threads never interleave. If the ring is full, producers wake
+// the flusher and yield rather than drop lines. The ring is a weak symbol,
+// shared by every translation unit. ulDIE and process exit flush it
+// synchronously. Lines longer than ulLOGLINEMAX are truncated.
+
+#ifndef ulLOGRINGSLOTS
+#define ulLOGRINGSLOTS   1024          // Must be a power of two
+#endif
+#define ulLOGBATCH       64            // Lines per writev()
+
+typedef struct ul__alogslot {
+    _Atomic size_t  seq;
+    size_t          len;
+    char            line[ulLOGLINEMAX];
+} ul__alogslot;
+
+typedef struct ul__alogring {
+    _Atomic size_t  head;              // Next slot a producer claims
+    size_t          tail;              // Next slot to drain (under drain)
+    _Atomic int     idle;              // Flusher is waiting on wake
+    pthread_mutex_t drain;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    ul__alogslot    slot[ulLOGRINGSLOTS];
+} ul__alogring;
+
+ulSHARED ul__alogring   ul__alog_ring;
+ulSHARED pthread_once_t ul__alog_once = PTHREAD_ONCE_INIT;
+
+
+static inline void ul__alog_writev(struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(STDERR_FILENO, iov, n);
+        if (w < 0) return;
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
 }
 
 
+// Drain up to one batch of ready lines. Returns the number written.
+static inline int ul__alog_drain(void) {
+    ul__alogring *r = &ul__alog_ring;
+    struct iovec iov[ulLOGBATCH];
+    size_t pos;
+    int n = 0;
 
-// Quick/dirty strdup() for non-POSIX systems
-// ------------------------------------------
-static inline char *ulstrdup(const char *s) {
-    size_t n = strlen(s);
-    char *r = malloc(n+1);
-    if (r) { memcpy(r, s, n); r[n] = '\0'; }
-    return r;
+    pthread_mutex_lock(&r->drain);
+    for (pos = r->tail; n < ulLOGBATCH; pos++, n++) {
+        ul__alogslot *sl = &r->slot[pos & (ulLOGRINGSLOTS - 1)];
+        if (atomic_load_explicit(&sl->seq, memory_order_acquire) != pos + 1) break;
+        iov[n].iov_base = sl->line;
+        iov[n].iov_len  = sl->len;
+    }
+    if (n > 0) {
+        ul__alog_writev(iov, n);
+        for (pos = r->tail; pos < r->tail + (size_t)n; pos++) {
+            atomic_store_explicit(&r->slot[pos & (ulLOGRINGSLOTS - 1)].seq,
+                                  pos + ulLOGRINGSLOTS, memory_order_release);
+        }
+        r->tail = pos;
+    }
+    pthread_mutex_unlock(&r->drain);
+
+    return n;
 }
 
 
-// Limited UTF-8 and UTF-16 Conversion Functions
-// ---------------------------------------------
+static inline void ul__alog_flush(void) {
+    while (ul__alog_drain() > 0);
+}
 
-static inline int32_t ulcdpt_from_utf8(const unsigned char *s) {
-    if (s[0] <= 0x7F) return s[0];
 
-    if ((0xC0 <= s[0] && s[0] <= 0xDF) &&     //  1100 0000 —— 1101 1111
-        (0x80 <= s[1] && s[1] <= 0xBF))       //  1000 0000 —— 1011 1111
-            return ((s[0] & 0x1F) <<  6) |         // 000xxxxx______
-                   ((s[1] & 0x3F) <<  0) ;         //       00xxxxxx
+static inline void *ul__alog_flusher(void *arg) {
+    ul__alogring *r = &ul__alog_ring;
+    (void)arg;
 
-    if ((0xE0 <= s[0] && s[0] <= 0xEF) &&     //  1110 0000 —— 1110 1111
-        (0x80 <= s[1] && s[1] <= 0xBF) &&     //  1000 0000 —— 1011 1111
-        (0x80 <= s[2] && s[2] <= 0xBF))       //  1000 0000 —— 1011 1111
-            return ((s[0] & 0x0F) << 12) |         // xxxx____________
-                   ((s[1] & 0x3F) <<  6) |         //   00xxxxxx______
-                   ((s[2] & 0x3F) <<  0) ;         //         00xxxxxx
+    for (;;) {
+        if (ul__alog_drain() > 0) continue;
 
-    if ((0xF0 <= s[0] && s[0] <= 0xF7) &&     //  1111 0000 —— 1111 0111
-        (0x80 <= s[1] && s[1] <= 0xBF) &&     //  1000 0000 —— 1011 1111
-        (0x80 <= s[2] && s[2] <= 0xBF) &&     //  1000 0000 —— 1011 1111
-        (0x80 <= s[3] && s[3] <= 0xBF))       //  1000 0000 —— 1011 1111
-            return ((s[0] & 0x07) << 18) |         // xxx__________________
-                   ((s[1] & 0x3F) << 12) |         //  00xxxxxx____________
-                   ((s[2] & 0x3F) <<  6) |         //        00xxxxxx______
-                   ((s[3] & 0x3F) <<  0) ;         //              00xxxxxx
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 10 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
 
-    /* Default -- maybe it isn't UTF-8? */
-    return s[0];
+        pthread_mutex_lock(&r->lock);
+        atomic_store(&r->idle, 1);
+        pthread_cond_timedwait(&r->wake, &r->lock, &ts);
+        atomic_store(&r->idle, 0);
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    return NULL;
 }
 
 
-static inline int32_t ulcdpt_from_utf16(uint16_t hi, uint16_t lo) {
-    if (0xD800 <= hi && hi <= 0xDBFF) {
-        if (0xDC00 <= lo && lo <= 0xDFFF) {
-            // We have a valid surrogate pair, so convert it.
-            // Unicode 15.0, Tbl 3-5 says UTF-16 surrogate pairs in form:
-            //         110110wwwwyyyyyy
-            //                   110111xxxxxxxxxx
-            // map to scalar code points of value:
-            //              uuuuuyyyyyyxxxxxxxxxx     (uuuuu=wwww+1)
-            return ((lo & 0x03FF)        |
-                   ((hi & 0x003F) << 10) |
-                   ((hi & 0x03C0) << 10) +
-                   ((     0x0040) << 10));
+static inline void ul__alog_init(void) {
+    ul__alogring *r = &ul__alog_ring;
+    pthread_t t;
+
+    for (size_t i = 0; i < ulLOGRINGSLOTS; i++) {
+        atomic_init(&r->slot[i].seq, i);
+    }
+    pthread_mutex_init(&r->drain, NULL);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    atexit(ul__alog_flush);
+
+    if (pthread_create(&t, NULL, ul__alog_flusher, NULL) == 0) pthread_detach(t);
+}
+
+
+static inline void ul__alog_wake(void) {
+    ul__alogring *r = &ul__alog_ring;
+    if (atomic_load_explicit(&r->idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+
+static inline void ul__alog_push(const char *line, size_t len) {
+    ul__alogring *r = &ul__alog_ring;
+    ul__alogslot *sl;
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    pthread_once(&ul__alog_once, ul__alog_init);
+
+    for (;;) {
+        sl = &r->slot[pos & (ulLOGRINGSLOTS - 1)];
+        size_t seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if ((ptrdiff_t)(seq - pos) < 0) {             // Ring is full
+            ul__alog_wake();
+            sched_yield();
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        }
+        else {
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
         }
     }
-    else if (!(0xDC00 <= lo && lo <= 0xDFFF)) {
-        return lo;
+
+    memcpy(sl->line, line, len);
+    sl->len = len;
+    atomic_store_explicit(&sl->seq, pos + 1, memory_order_release);
+    ul__alog_wake();
+}
+
+
+#if defined( __GNUC__ )
+__attribute__((format(printf, 6, 7)))
+#endif
+static inline int ul__alog(const char *pfx, const char *file, const char *func,
+                           int line, const char *sfx, const char *fmt, ...) {
+    _Thread_local static char buf[ulLOGLINEMAX];
+    size_t sfxlen = strlen(sfx), max = sizeof buf - sfxlen;
+    va_list ap;
+    int n, m;
+
+    n = snprintf(buf, max, "%s%s:%s() line %d: ", pfx, file, func, line);
+    if (n < 0) return 0;
+    if ((size_t)n < max) {
+        va_start(ap, fmt);
+        m = vsnprintf(buf + n, max - (size_t)n, fmt, ap);
+        va_end(ap);
+        if (m > 0) n += m;
     }
+    if ((size_t)n >= max) n = (int)max - 1;
+    memcpy(buf + n, sfx, sfxlen);
 
-    return '?';
+    ul__alog_push(buf, (size_t)n + sfxlen);
+    return n + (int)sfxlen;
 }
 
+#define ulLOG(...) \
+    ul__alog("In ", __FILE__, __func__, __LINE__, "\n", __VA_ARGS__)
 
-static inline void ulutf16_from_cdpt(int32_t cdpt, uint16_t *hi, uint16_t *lo) {
-    if (0 <= cdpt && cdpt <= 65535) {
-        *hi = 0;
-        *lo = (uint16_t)cdpt;
-        return;
+#else
+
+// Default logging backend
+// -----------------------
+// ulLOG/ulDBUG/ulDIE build each whole line in a stack buffer and hand it to
+// stderr with one write(), so lines from different threads do not
+// interleave and no stdio lock is taken. The "In file:func() line N: "
+// prefix comes from the typed formatters; only the caller's own format
+// string goes through vsnprintf. Lines longer than ulLOGLINEMAX fall back to
+// fprintf rather than being truncated.
+
+#if defined( __GNUC__ )
+__attribute__((format(printf, 6, 7)))
+#endif
+static inline int ul__log(const char *pfx, const char *file, const char *func,
+                          int line, const char *sfx, const char *fmt, ...) {
+    char buf[ulLOGLINEMAX];
+    size_t sfxlen = strlen(sfx), n;
+    ulfmtbuf b;
+    va_list ap;
+    int m;
+
+    ulfmt_init(&b, buf, sizeof buf - sfxlen);
+    ulfmt_str(&b, pfx);
+    ulfmt_str(&b, file);
+    ulfmt_chr(&b, ':');
+    ulfmt_str(&b, func);
+    ulfmt_mem(&b, "() line ", 8);
+    ulfmt_int(&b, line);
+    ulfmt_mem(&b, ": ", 2);
+    n = ulfmt_len(&b);
+
+    va_start(ap, fmt);
+    m = vsnprintf(b.p, (size_t)(b.end - b.p), fmt, ap);
+    va_end(ap);
+    if (m < 0) return 0;
+
+    if ((size_t)m >= (size_t)(b.end - b.p)) {
+        va_start(ap, fmt);
+        m = fprintf(stderr, "%s%s:%s() line %d: ", pfx, file, func, line) >= 0 &&
+            vfprintf(stderr, fmt, ap) >= 0 &&
+            fputs(sfx, stderr) >= 0;
+        va_end(ap);
+        return m;
     }
 
-    else {
-        *lo = 0xDC00 | (cdpt & 0x03FF);
-        *hi = (uint16_t)(cdpt >> 10);
-        *hi = *hi - (1<<6);
-        *hi = *hi | 0xD800;
-        return;
+    n += (size_t)m;
+    memcpy(buf + n, sfx, sfxlen);
+    ul__fmt_stderr(buf, n + sfxlen);
+    return (int)(n + sfxlen);
+}
+
+#define ulLOG(...) \
+    ul__log("In ", __FILE__, __func__, __LINE__, "\n", __VA_ARGS__)
+
+#endif
+
+
+// Log levels
+// ----------
+// ulLOGERR/ulLOGWARN/ulLOGINFO/ulDBUG log at fixed levels; ulLOGAT takes the
+// level as its first argument. Levels above ulLOGLEVEL are compiled out.
+// The rest are filtered at run time against a level read from $ULLOGLEVEL
+// ("error", "warn", "info", "debug", or 1-4) on first use, or set with
+// ulloglevel_set(). The check is a single relaxed atomic load. With no
+// environment setting, everything compiled in is logged; an unrecognised
+// setting is reported once on stderr and likewise ignored.
+//
+// ulLOGEVERY(lvl, n, ...) logs the 1st, n+1st, 2n+1st... call at its site,
+// or every call if n <= 1. ulLOGRATE(lvl, persec, ...) logs at most persec
+// calls per second at its site, then notes how many it suppressed when the
+// next second begins; persec == 0 suppresses the site entirely. Both keep
+// their counters in static per-site storage and are statements.
+
+enum { ulLVL_NONE, ulLVL_ERROR, ulLVL_WARN, ulLVL_INFO, ulLVL_DEBUG };
+
+#ifndef ulLOGLEVEL
+  #ifdef ulNEEDDBUG
+    #define ulLOGLEVEL ulLVL_DEBUG
+  #else
+    #define ulLOGLEVEL ulLVL_INFO
+  #endif
+#endif
+
+ulSHARED _Atomic int ul__loglevel = -1;
+
+static inline int ul__loglevel_init(void) {
+    static const char *names[] = { "none", "error", "warn", "info", "debug" };
+    static _Atomic int warned;
+    const char *e = getenv("ULLOGLEVEL");
+    int lvl = ulLOGLEVEL, found = !e;
+
+    if (e && '0' <= e[0] && e[0] <= '9') {
+        lvl = atoi(e);
+        found = 1;
+    }
+    else if (e) {
+        for (int i = 0; i <= ulLVL_DEBUG; i++) {
+            if (strcmp(e, names[i]) == 0) { lvl = i; found = 1; }
+        }
     }
+    if (!found && !atomic_exchange_explicit(&warned, 1, memory_order_relaxed)) {
+        fprintf(stderr, "Ignoring unrecognised ULLOGLEVEL \"%s\"\n", e);
+    }
+
+    atomic_store_explicit(&ul__loglevel, lvl, memory_order_relaxed);
+    return lvl;
 }
 
+static inline int ulloglevel_get(void) {
+    int lvl = atomic_load_explicit(&ul__loglevel, memory_order_relaxed);
+    return lvl < 0 ? ul__loglevel_init() : lvl;
+}
 
-static inline unsigned char *ulutf8_from_cdpt(int32_t c) {
-    _Thread_local static unsigned char u[5];
-    if (c<0 || (0xD800 <= c&&c <= 0xDBFF)) u[0]= '\0';
-    else if (c < 0x80) {               // Up to 7 bits
-        u[0]= (unsigned char)(c>>0   & 0x7F);  // 7 bits –> 0xxxxxxx
-        u[1]= '\0';
-    }
-    else if (c < 0x800) {              // Up to 11 bits
-        u[0]= (unsigned char)((c>>6  & 0x1F)|0xC0);  // 5 bits –> 110xxxxx
-        u[1]= (unsigned char)((c     & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[2]= '\0';
-    }
-    else if (c < 0x10000) {            // Up to 16 bits
-        u[0]= (unsigned char)((c>>12 & 0x0F)|0xE0);  // 4 bits –> 1110xxxx
-        u[1]= (unsigned char)((c>>6  & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[2]= (unsigned char)((c     & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[3]= '\0';
-    }
-    else if (c < 0x110000) {           // Up to 21 bits
-        u[0]= (unsigned char)((c>>18 & 0x07)|0xF0);  // 3 bits –> 11110xxx
-        u[1]= (unsigned char)((c>>12 & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[2]= (unsigned char)((c>>6  & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[3]= (unsigned char)((c     & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
-        u[4]= '\0';
-    }
-    else u[0]= '\0';
-    return u;
+static inline void ulloglevel_set(int lvl) {
+    atomic_store_explicit(&ul__loglevel, lvl, memory_order_relaxed);
+}
+
+
+typedef struct ul__lograte {
+    _Atomic uint64_t  window;          // Second (high 32) and count (low 32)
+    _Atomic uint32_t  dropped;
+} ul__lograte;
+
+// Returns 0 to suppress, else 1 + the number suppressed in past windows.
+static inline uint32_t ul__lograte_admit(ul__lograte *r, uint32_t persec) {
+    uint32_t now = (uint32_t)time(NULL);
+    uint64_t w = atomic_load_explicit(&r->window, memory_order_relaxed), nw;
+
+    if (persec == 0) return 0;
+    do {
+        if ((uint32_t)(w >> 32) != now)  nw = ((uint64_t)now << 32) | 1;
+        else if ((uint32_t)w < persec)   nw = w + 1;
+        else {
+            atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&r->window, &w, nw,
+                memory_order_relaxed, memory_order_relaxed));
+
+    if ((uint32_t)nw != 1) return 1;
+    return 1 + atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+}
+
+#define ulLOGAT(lvl, ...) \
+    ((lvl) <= ulLOGLEVEL && (lvl) <= ulloglevel_get() ? ulLOG(__VA_ARGS__) : 0)
+
+#define ulLOGERR(...)  ulLOGAT(ulLVL_ERROR, __VA_ARGS__)
+#define ulLOGWARN(...) ulLOGAT(ulLVL_WARN,  __VA_ARGS__)
+#define ulLOGINFO(...) ulLOGAT(ulLVL_INFO,  __VA_ARGS__)
+
+#define ulLOGEVERY(lvl, n, ...) do {                                           \
+    static _Atomic uint32_t ul__every;                                         \
+    if ((lvl) <= ulLOGLEVEL && (lvl) <= ulloglevel_get() &&                    \
+        ((n) <= 1 ||                                                           \
+         atomic_fetch_add_explicit(&ul__every, 1, memory_order_relaxed)        \
+            % (uint32_t)(n) == 0))                                             \
+        ulLOG(__VA_ARGS__);                                                    \
+    } while (0)
+
+#define ulLOGRATE(lvl, persec, ...) do {                                       \
+    static ul__lograte ul__rate;                                               \
+    uint32_t ul__admit;                                                        \
+    if ((lvl) <= ulLOGLEVEL && (lvl) <= ulloglevel_get() &&                    \
+        (ul__admit = ul__lograte_admit(&ul__rate, (uint32_t)(persec))) != 0) { \
+        if (ul__admit > 1)                                                     \
+            ulLOG("(%u similar messages suppressed)", ul__admit - 1);          \
+        ulLOG(__VA_ARGS__);                                                    \
+    }                                                                          \
+    } while (0)
+
+#ifndef ulNEEDDBUG
+#define ulDBUG(...) ((void)0)
+#else
+#define ulDBUG(...) (ulLOGAT(ulLVL_DEBUG, __VA_ARGS__))
+#endif
+
+// Variable dumps
+// --------------
+// ulVARDBUG(x) prints "file:line x=value", choosing a typed writer for x
+// with _Generic: characters as themselves, integers and floating values in
+// decimal, strings quoted, other pointers in hex, and anything else (a
+// struct, say) as a full hex dump. ulHEXDBUG(x) always hex-dumps x, 16 bytes
+// per line with offsets and ASCII. ulCDPTDBUG(x) prints a code point as
+// U+XXXX and the character, since _Generic cannot tell int32_t from int.
+// With GCC or Clang, x is evaluated once and may be any expression;
+// otherwise, and always for ulHEXDBUG, it must be an lvalue. Each record is
+// built on the stack and written whole, like the default ulLOG backend.
+
+enum { ul__VD_CHAR, ul__VD_BOOL, ul__VD_INT, ul__VD_UINT, ul__VD_FLOAT,
+       ul__VD_STR, ul__VD_CHARS, ul__VD_PTR, ul__VD_CDPT, ul__VD_HEX };
+
+#if defined( ulASYNCLOG )
+#define ul__DUMPBUFSZ    ulLOGLINEMAX   // One ring slot per write
+#else
+#define ul__DUMPBUFSZ    4096
+#endif
+
+static inline void ul__dbug_emit(const char *s, size_t n) {
+#if defined( ulASYNCLOG )
+    ul__alog_push(s, n);
+#else
+    ul__fmt_stderr(s, n);
+#endif
+}
+
+static inline void ul__hexdbug(const char *file, int line, const char *name,
+                               const void *p, size_t n) {
+    const unsigned char *s = p;
+    char buf[ul__DUMPBUFSZ];
+    ulfmtbuf b;
+
+    ulfmt_init(&b, buf, sizeof buf);
+    ulfmt_str(&b, file);
+    ulfmt_chr(&b, ':');
+    ulfmt_int(&b, line);
+    ulfmt_chr(&b, ' ');
+    ulfmt_str(&b, name);
+    ulfmt_mem(&b, " (", 2);
+    ulfmt_uint(&b, n);
+    ulfmt_mem(&b, n == 1 ? " byte):\n" : " bytes):\n", n == 1 ? 8 : 9);
+
+    for (size_t off = 0; off < n; off += 16) {
+        size_t k = n - off < 16 ? n - off : 16;
+        char t[80], *q = t;
+
+        if (b.end - b.p < (ptrdiff_t)sizeof t) {
+            ul__dbug_emit(buf, ulfmt_len(&b));
+            ulfmt_init(&b, buf, sizeof buf);
+        }
+        *q++ = ' ';
+        *q++ = ' ';
+        for (int sh = off >> 16 ? 28 : 12; sh >= 0; sh -= 4)
+            *q++ = "0123456789abcdef"[off >> sh & 15];
+        *q++ = ' ';
+        for (size_t i = 0; i < 16; i++) {
+            *q++ = ' ';
+            *q++ = i < k ? "0123456789abcdef"[s[off + i] >> 4] : ' ';
+            *q++ = i < k ? "0123456789abcdef"[s[off + i] & 15] : ' ';
+        }
+        *q++ = ' ';
+        *q++ = ' ';
+        *q++ = '|';
+        for (size_t i = 0; i < k; i++)
+            *q++ = (0x20 <= s[off + i] && s[off + i] < 0x7F) ? (char)s[off + i] : '.';
+        *q++ = '|';
+        *q++ = '\n';
+        ulfmt_mem(&b, t, (size_t)(q - t));
+    }
+    ul__dbug_emit(buf, ulfmt_len(&b));
+}
+
+static inline void ul__vardbug(const char *file, int line, const char *name,
+                               int kind, const void *p, size_t n) {
+    char buf[ulLOGLINEMAX];
+    ulfmtbuf b;
+
+    if (kind == ul__VD_HEX) {
+        ul__hexdbug(file, line, name, p, n);
+        return;
+    }
+
+    ulfmt_init(&b, buf, sizeof buf - 1);
+    ulfmt_str(&b, file);
+    ulfmt_chr(&b, ':');
+    ulfmt_int(&b, line);
+    ulfmt_chr(&b, ' ');
+    ulfmt_str(&b, name);
+    ulfmt_chr(&b, '=');
+
+    switch (kind) {
+    case ul__VD_CHAR:
+        ulfmt_chr(&b, *(const char *)p);
+        break;
+    case ul__VD_BOOL:
+        ul__fmt_bool(&b, *(const _Bool *)p);
+        break;
+    case ul__VD_INT: {
+        int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+        if      (n == 1) { memcpy(&i8,  p, 1); ulfmt_int(&b, i8);  }
+        else if (n == 2) { memcpy(&i16, p, 2); ulfmt_int(&b, i16); }
+        else if (n == 4) { memcpy(&i32, p, 4); ulfmt_int(&b, i32); }
+        else             { memcpy(&i64, p, 8); ulfmt_int(&b, i64); }
+        break;
+    }
+    case ul__VD_UINT: {
+        uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+        if      (n == 1) { memcpy(&u8,  p, 1); ulfmt_uint(&b, u8);  }
+        else if (n == 2) { memcpy(&u16, p, 2); ulfmt_uint(&b, u16); }
+        else if (n == 4) { memcpy(&u32, p, 4); ulfmt_uint(&b, u32); }
+        else             { memcpy(&u64, p, 8); ulfmt_uint(&b, u64); }
+        break;
+    }
+    case ul__VD_FLOAT: {
+        float f; double d; long double ld;
+        if      (n == sizeof f) { memcpy(&f,  p, n); ulfmt_double(&b, f); }
+        else if (n == sizeof d) { memcpy(&d,  p, n); ulfmt_double(&b, d); }
+        else                    { memcpy(&ld, p, n); ulfmt_double(&b, (double)ld); }
+        break;
+    }
+    case ul__VD_STR: {
+        const char *s;
+        memcpy(&s, p, sizeof s);
+        if (!s) { ulfmt_mem(&b, "NULL", 4); break; }
+        ulfmt_chr(&b, '"');
+        ulfmt_str(&b, s);
+        ulfmt_chr(&b, '"');
+        break;
+    }
+    case ul__VD_CHARS: {
+        const char *z = memchr(p, '\0', n);
+        ulfmt_chr(&b, '"');
+        ulfmt_mem(&b, p, z ? (size_t)(z - (const char *)p) : n);
+        ulfmt_chr(&b, '"');
+        break;
+    }
+    case ul__VD_PTR: {
+        const void *v;
+        memcpy(&v, p, sizeof v);
+        ulfmt_ptr(&b, v);
+        break;
+    }
+    case ul__VD_CDPT: {
+        int32_t c;
+        memcpy(&c, p, sizeof c);
+        ulfmt_cdpt(&b, c);
+        break;
+    }
+    }
+
+    b.end++;
+    ulfmt_chr(&b, '\n');
+    ul__dbug_emit(buf, ulfmt_len(&b));
+}
+
+#define ul__VDKIND(x) _Generic((x),                                            \
+             _Bool: ul__VD_BOOL,                                               \
+              char: ul__VD_CHAR,                                               \
+       signed char: ul__VD_CHAR,                                               \
+     unsigned char: ul__VD_CHAR,                                               \
+             short: ul__VD_INT,                                                \
+               int: ul__VD_INT,                                                \
+              long: ul__VD_INT,                                                \
+         long long: ul__VD_INT,                                                \
+    unsigned short: ul__VD_UINT,                                               \
+      unsigned int: ul__VD_UINT,                                               \
+     unsigned long: ul__VD_UINT,                                               \
+unsigned long long: ul__VD_UINT,                                               \
+             float: ul__VD_FLOAT,                                              \
+            double: ul__VD_FLOAT,                                              \
+       long double: ul__VD_FLOAT,                                              \
+            char *: ul__VD_STR,                                                \
+      const char *: ul__VD_STR,                                                \
+     signed char *: ul__VD_STR,                                                \
+   unsigned char *: ul__VD_STR,                                                \
+const signed char *: ul__VD_STR,                                               \
+const unsigned char *: ul__VD_STR,                                             \
+            void *: ul__VD_PTR,                                                \
+      const void *: ul__VD_PTR,                                                \
+           default: ul__VD_HEX)
+
+#ifndef ulNEEDDBUG
+#define ulVARDBUG(x)   ((void)0)
+#define ulHEXDBUG(x)   ((void)0)
+#define ulCDPTDBUG(x)  ((void)0)
+#else
+#define ulHEXDBUG(x)   ul__hexdbug(__FILE__, __LINE__, #x, &(x), sizeof(x))
+#define ulCDPTDBUG(x)  ul__vardbug(__FILE__, __LINE__, #x, ul__VD_CDPT,        \
+                                   &(int32_t){ (int32_t)(x) }, sizeof(int32_t))
+#if defined( __GNUC__ )
+// The copy decays arrays, so a char array prints as a string and any other
+// array or pointer (type class 5 to the compiler) as an address.
+#define ulVARDBUG(x) (__extension__({                                          \
+    __auto_type ul__v = (x);                                                   \
+    ul__vardbug(__FILE__, __LINE__, #x,                                        \
+                ul__VDKIND(ul__v) == ul__VD_HEX &&                             \
+                __builtin_classify_type(ul__v) == 5 ? ul__VD_PTR :             \
+                ul__VDKIND(ul__v), &ul__v, sizeof ul__v);                      \
+    }))
+#else
+#define ulVARDBUG(x)   ul__vardbug(__FILE__, __LINE__, #x,                     \
+                          _Generic(&(x), char (*)[sizeof(x)]: ul__VD_CHARS,    \
+                                   const char (*)[sizeof(x)]: ul__VD_CHARS,    \
+                                   default: ul__VDKIND(x)),                    \
+                          &(x), sizeof(x))
+#endif
+#endif
+
+// ulDIE sequences its steps with commas, so exit() runs whatever the
+// message writers return, and still yields an int for use in expressions.
+static inline int ul__die(void) {
+    exit(EXIT_FAILURE);
+}
+
+#if defined( ulBINLOG )
+#define ulDIE(...) (\
+    ul__blog_flushall(),                                                     \
+    fprintf(stderr, "DIED: %s:%s() line %d: ",__FILE__,__func__,__LINE__),   \
+    fprintf(stderr, __VA_ARGS__),                                            \
+    fprintf(stderr, "\n\n\n"),                                               \
+    ul__die()\
+    )
+#elif defined( ulASYNCLOG )
+#define ulDIE(...) (\
+    ul__alog("DIED: ", __FILE__, __func__, __LINE__, "\n\n\n", __VA_ARGS__), \
+    ul__alog_flush(),                                                        \
+    ul__die()\
+    )
+#else
+#define ulDIE(...) (\
+    ul__log("DIED: ", __FILE__, __func__, __LINE__, "\n\n\n", __VA_ARGS__),  \
+    ul__die()\
+    )
+#endif
+
+
+
+
+#if defined( ulTRACEBUF )
+
+// Buffered function tracing (POSIX only)
+// --------------------------------------
+// With ulTRACEBUF defined, ulBEGIN_FUNCTION/ulRETURN/ulFAIL record entry
+// and exit events with a CLOCK_MONOTONIC timestamp into a fixed-size ring of
+// ulTRACEBUFSZ events per thread, overwriting the oldest when full. Unlike
+// ulNEEDTRACE, this mode stays enabled under NDEBUG. ultrace_dump() writes
+// every thread's buffer as <prefix>.json (Chrome trace_event format, for
+// chrome://tracing or Perfetto) and <prefix>.folded (one line per distinct
+// stack with its total self time in nanoseconds, for flamegraph.pl). The prefix is $ULTRACE, or
+// "ultrace". Buffers are dumped at exit, and ultrace_dump_on_signal(sig)
+// makes the next traced call after sig arrives dump them as well. When a
+// thread exits its buffer is kept, events and all, and handed to the next
+// thread that starts tracing, so memory stays bounded by the peak number of
+// traced threads rather than growing with thread churn. Each event carries
+// its thread number, so a reused ring still dumps correctly.
+
+#ifndef ulTRACEBUFSZ
+#define ulTRACEBUFSZ     65536         // Events per thread; a power of two
+#endif
+#define ulTRACEMAXDEPTH  256
+
+typedef struct ul__traceev {
+    uint64_t             ns;
+    const char          *func;
+    int                  enter;
+    uint32_t             tid;
+} ul__traceev;
+
+typedef struct ul__tracebuf {
+    struct ul__tracebuf *next;
+    uint32_t             tid;          // Current owner
+    int                  idle;         // Owner exited (under state lock)
+    _Atomic uint64_t     head;         // Events ever recorded
+    ul__traceev          ev[ulTRACEBUFSZ];
+} ul__tracebuf;
+
+typedef struct ul__tracestate {
+    pthread_mutex_t      lock;
+    pthread_once_t       once;
+    pthread_key_t        key;
+    uint32_t             nthreads;
+    ul__tracebuf        *bufs;
+    volatile sig_atomic_t dumpreq;
+} ul__tracestate;
+
+ulSHARED ul__tracestate ul__trace_state = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT, 0, 0, NULL, 0
+};
+ulSHARED _Thread_local ul__tracebuf *ul__trace_tbuf;
+
+
+// Folded stacks are summed per distinct stack before writing. Each stack is
+// a node in a call tree, found by (parent, function name) in an open-
+// addressing hash table, and samples add self time to their node, so a
+// million calls along the same path become one line.
+typedef struct ul__tracenode {
+    const char          *func;
+    uint32_t             parent;       // Index of the caller; 0 is the root
+    uint64_t             self;         // Nanoseconds with this stack on top
+} ul__tracenode;
+
+typedef struct ul__tracefold {
+    ul__tracenode       *node;         // node[0] is the root
+    uint32_t            *slot;         // Node index + 1 per slot, 0 if empty
+    uint32_t             n, cap;       // Slots are 2 * cap, a power of two
+} ul__tracefold;
+
+static inline uint32_t ul__trace_hash(uint32_t parent, const char *func) {
+    uint32_t h = 2166136261U ^ parent;
+    while (*func) h = (h ^ (unsigned char)*func++) * 16777619U;
+    return h;
+}
+
+static inline int ul__trace_foldgrow(ul__tracefold *f) {
+    uint32_t cap = f->cap ? f->cap * 2 : 1024, mask = 2 * cap - 1;
+    ul__tracenode *node = realloc(f->node, cap * sizeof *node);
+    uint32_t *slot;
+
+    if (!node) return -1;
+    f->node = node;
+    if ((slot = calloc(2 * (size_t)cap, sizeof *slot)) == NULL) return -1;
+    for (uint32_t i = 1; i < f->n; i++) {
+        uint32_t h = ul__trace_hash(node[i].parent, node[i].func) & mask;
+        while (slot[h]) h = (h + 1) & mask;
+        slot[h] = i + 1;
+    }
+    (free)(f->slot);
+    f->slot = slot;
+    f->cap  = cap;
+    return 0;
+}
+
+// Node for func called from parent, or 0 if out of memory
+static inline uint32_t ul__trace_foldnode(ul__tracefold *f, uint32_t parent,
+                                          const char *func) {
+    uint32_t h, i;
+
+    if (f->n >= f->cap && ul__trace_foldgrow(f) < 0) return 0;
+    for (h = ul__trace_hash(parent, func) & (2 * f->cap - 1); (i = f->slot[h]) != 0;
+         h = (h + 1) & (2 * f->cap - 1)) {
+        const ul__tracenode *nd = &f->node[i - 1];
+        if (nd->parent == parent && (nd->func == func || !strcmp(nd->func, func))) {
+            return i - 1;
+        }
+    }
+    f->node[f->n] = (ul__tracenode){ func, parent, 0 };
+    f->slot[h] = f->n + 1;
+    return f->n++;
+}
+
+static inline void ul__trace_folded(ul__tracefold *f, const ul__tracebuf *b,
+                                    uint64_t from, uint64_t to) {
+    uint32_t stack[ulTRACEMAXDEPTH + 1] = { 0 };   // stack[d] is the node at depth d
+    int depth = 0;
+    uint64_t last = 0;
+    uint32_t tid = 0;
+
+    if (f->cap == 0 && ul__trace_foldgrow(f) < 0) return;
+    if (f->n == 0) f->node[f->n++] = (ul__tracenode){ "", 0, 0 };
+
+    for (uint64_t i = from; i < to; i++) {
+        const ul__traceev *e = &b->ev[i & (ulTRACEBUFSZ - 1)];
+
+        if (e->tid != tid) {           // A new owner starts with no stack
+            tid = e->tid;
+            depth = 0;
+        }
+        if (depth > 0 && depth <= ulTRACEMAXDEPTH && e->ns > last && stack[depth]) {
+            f->node[stack[depth]].self += e->ns - last;
+        }
+        last = e->ns;
+
+        if (e->enter) {
+            if (depth < ulTRACEMAXDEPTH) {
+                stack[depth + 1] = stack[depth] || depth == 0
+                                 ? ul__trace_foldnode(f, stack[depth], e->func) : 0;
+            }
+            depth++;
+        }
+        else if (depth > 0) {
+            depth--;
+        }
+    }
+}
+
+// One line per stack with self time, root first; frees f
+static inline void ul__trace_foldwrite(FILE *fp, ul__tracefold *f) {
+    const char *path[ulTRACEMAXDEPTH];
+
+    for (uint32_t i = 1; i < f->n; i++) {
+        int d = 0;
+        if (f->node[i].self == 0) continue;
+        for (uint32_t k = i; k && d < ulTRACEMAXDEPTH; k = f->node[k].parent) {
+            path[d++] = f->node[k].func;
+        }
+        while (d-- > 0) fprintf(fp, d ? "%s;" : "%s", path[d]);
+        fprintf(fp, " %llu\n", (unsigned long long)f->node[i].self);
+    }
+    (free)(f->node);
+    (free)(f->slot);
+}
+
+
+static inline int ultrace_dump(const char *prefix) {
+    char path[4096];
+    FILE *json, *folded;
+    ul__tracefold fold = { NULL, NULL, 0, 0 };
+    int first = 1;
+
+    if (!prefix) prefix = getenv("ULTRACE");
+    if (!prefix) prefix = "ultrace";
+
+    snprintf(path, sizeof path, "%s.json", prefix);
+    if ((json = fopen(path, "w")) == NULL) return -1;
+    snprintf(path, sizeof path, "%s.folded", prefix);
+    if ((folded = fopen(path, "w")) == NULL) { fclose(json); return -1; }
+
+    fprintf(json, "{\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&ul__trace_state.lock);
+    for (ul__tracebuf *b = ul__trace_state.bufs; b; b = b->next) {
+        uint64_t to   = atomic_load_explicit(&b->head, memory_order_acquire);
+        uint64_t from = to > ulTRACEBUFSZ ? to - ulTRACEBUFSZ : 0;
+
+        for (uint64_t i = from; i < to; i++) {
+            const ul__traceev *e = &b->ev[i & (ulTRACEBUFSZ - 1)];
+            fprintf(json, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                          "\"pid\":%ld,\"tid\":%llu}",
+                    first ? "" : ",\n", e->func, e->enter ? 'B' : 'E',
+                    (unsigned long long)(e->ns / 1000), (unsigned)(e->ns % 1000),
+                    (long)getpid(), (unsigned long long)e->tid);
+            first = 0;
+        }
+        ul__trace_folded(&fold, b, from, to);
+    }
+    pthread_mutex_unlock(&ul__trace_state.lock);
+    ul__trace_foldwrite(folded, &fold);
+
+    fprintf(json, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(folded);
+    return fclose(json) == 0 ? 0 : -1;
+}
+
+
+static inline void ul__trace_atexit(void) {
+    ultrace_dump(NULL);
+}
+
+static inline void ul__trace_threadexit(void *arg) {
+    ul__tracebuf *b = arg;
+    pthread_mutex_lock(&ul__trace_state.lock);
+    b->idle = 1;
+    pthread_mutex_unlock(&ul__trace_state.lock);
+}
+
+static inline void ul__trace_init(void) {
+    pthread_key_create(&ul__trace_state.key, ul__trace_threadexit);
+    atexit(ul__trace_atexit);
+}
+
+static inline void ul__trace_onsignal(int sig) {
+    (void)sig;
+    ul__trace_state.dumpreq = 1;
+}
+
+static inline int ultrace_dump_on_signal(int sig) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = ul__trace_onsignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(sig, &sa, NULL);
+}
+
+
+static inline ul__tracebuf *ul__trace_thread(void) {
+    ul__tracebuf *b;
+
+    pthread_once(&ul__trace_state.once, ul__trace_init);
+
+    pthread_mutex_lock(&ul__trace_state.lock);
+    for (b = ul__trace_state.bufs; b && !b->idle; b = b->next) {}
+    if (!b && (b = calloc(1, sizeof *b)) != NULL) {
+        b->next = ul__trace_state.bufs;
+        ul__trace_state.bufs = b;
+    }
+    if (b) {
+        b->idle = 0;
+        b->tid  = ++ul__trace_state.nthreads;
+    }
+    pthread_mutex_unlock(&ul__trace_state.lock);
+
+    if (b) pthread_setspecific(ul__trace_state.key, b);
+    return ul__trace_tbuf = b;
+}
+
+
+static inline void ultrace(int x, const char *funcname) {
+    ul__tracebuf *b = ul__trace_tbuf ? ul__trace_tbuf : ul__trace_thread();
+    struct timespec ts;
+    uint64_t h;
+
+    if (!b) return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    h = atomic_load_explicit(&b->head, memory_order_relaxed);
+    b->ev[h & (ulTRACEBUFSZ - 1)] = (ul__traceev){
+        (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec, funcname, x > 0, b->tid
+    };
+    atomic_store_explicit(&b->head, h + 1, memory_order_release);
+
+    if (ul__trace_state.dumpreq) {
+        ul__trace_state.dumpreq = 0;
+        ultrace_dump(NULL);
+    }
+}
+#define ulTRACE(x)       ultrace(x, __func__)
+
+#elif defined( ulNEEDTRACE )
+static inline void ultrace(int x, const char *funcname) {
+    static _Thread_local int spaces = 0;
+    if (x > 0) {
+        fprintf(stderr,"%*cEntering %s()\n", spaces, ' ', funcname);
+        spaces+=4;
+    } else {
+        if (spaces >= 4) spaces-=4;
+        fprintf(stderr,"%*cExiting %s()\n",  spaces, ' ', funcname);
+    }
+}
+#define ulTRACE(x)       ultrace(x, __func__)
+#else
+#define ulTRACE(x)       ((void)0)
+#endif
+
+#define ulBEGIN_FUNCTION ulTRACE(1);
+#define ulRETURN(x)      do { ulTRACE(0);         return x;    } while(0)
+#define ulFAIL(x,...)    do { ulLOG(__VA_ARGS__); ulRETURN(x); } while(0)
+
+
+
+
+
+
+
+
+
+
+
+
+//===========================================================================
+//                            Memory functionality
+//===========================================================================
+#define ulfree(x)        do { (free)(x); x = NULL; } while (0)
+#define ulmemzero(x, y)  memset(x, 0, y)
+
+// Zero memory in a way the optimizer may not elide, even when the buffer is
+// dead afterward. Uses memset_s() if the including file asked for Annex K
+// (__STDC_WANT_LIB_EXT1__ before <string.h>) and the library provides it,
+// else explicit_bzero() where available. Failing those, it runs the
+// (vectorized) library memset() followed by a compiler barrier that claims
+// to read the buffer, which survives -O3 and LTO; tests/test_memzero.c
+// checks this.
+#if defined( __GLIBC__ ) && defined( _DEFAULT_SOURCE ) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+  #define ulHAVEEXPLICITBZERO
+#elif defined( __OpenBSD__ ) || defined( __FreeBSD__ )
+  #define ulHAVEEXPLICITBZERO
+#endif
+
+static inline void ulmemzerosecure(void *const p, const size_t z) {
+#if defined( __STDC_LIB_EXT1__ ) && defined( __STDC_WANT_LIB_EXT1__ ) && \
+    __STDC_WANT_LIB_EXT1__
+    memset_s(p, z, 0, z);
+#elif defined( ulHAVEEXPLICITBZERO )
+    explicit_bzero(p, z);
+#elif defined( __GNUC__ )
+    memset(p, 0, z);
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+    static void *(*const volatile memset_)(void *, int, size_t) = memset;
+    memset_(p, 0, z);
+#endif
+}
+
+
+
+
+// Arena (bump) allocation
+// -----------------------
+// An arena hands out max_align_t-aligned memory from large chunks and frees
+// it all at once. ularena_mark() records the current position, and
+// ularena_rewind() releases everything allocated since, in time proportional
+// to the number of chunks rather than allocations. ularena_reset() rewinds
+// to empty. Released chunks are kept for reuse until ularena_destroy().
+// ularena_adopt() hands an existing malloc() block to the arena, which frees
+// it when the arena is rewound past that point, without copying it.
+
+#ifndef ulARENACHUNK
+#define ulARENACHUNK     65536
+#endif
+
+typedef struct ul__arenachunk {
+    struct ul__arenachunk *prev;
+    size_t                 size;
+    size_t                 used;
+    max_align_t            data[];
+} ul__arenachunk;
+
+typedef struct ul__arenaadopt {
+    struct ul__arenaadopt *next;
+    void                  *p;
+} ul__arenaadopt;
+
+typedef struct ularena {
+    ul__arenachunk        *cur;
+    ul__arenachunk        *spare;
+    ul__arenaadopt        *adopted;
+    size_t                 chunksize;
+} ularena;
+
+typedef struct ularenamark {
+    ul__arenachunk        *chunk;
+    size_t                 used;
+    ul__arenaadopt        *adopted;
+} ularenamark;
+
+
+static inline ularena *ularena_create(size_t chunksize) {
+    ularena *a = malloc(sizeof *a);
+    if (!a) return NULL;
+    a->cur = a->spare = NULL;
+    a->adopted = NULL;
+    a->chunksize = chunksize ? chunksize : ulARENACHUNK;
+    return a;
+}
+
+
+static inline void *ularena_alloc(ularena *a, size_t n) {
+    ul__arenachunk *c = a->cur;
+    void *p;
+
+    n = (n + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    if (n == 0) n = _Alignof(max_align_t);
+
+    if (!c || c->size - c->used < n) {
+        if (a->spare && a->spare->size >= n) {
+            c = a->spare;
+            a->spare = c->prev;
+        }
+        else {
+            size_t z = n > a->chunksize ? n : a->chunksize;
+            if (z > SIZE_MAX - sizeof *c) return NULL;
+            if ((c = malloc(sizeof *c + z)) == NULL) return NULL;
+            c->size = z;
+        }
+        c->used = 0;
+        c->prev = a->cur;
+        a->cur = c;
+    }
+
+    p = (char *)c->data + c->used;
+    c->used += n;
+    return p;
+}
+
+
+static inline char *ularena_strdup(ularena *a, const char *s) {
+    size_t n = strlen(s);
+    char *r = ularena_alloc(a, n + 1);
+    if (r) { memcpy(r, s, n); r[n] = '\0'; }
+    return r;
+}
+
+
+static inline void *ularena_adopt(ularena *a, void *p) {
+    ul__arenaadopt *ad;
+    if (!p || (ad = ularena_alloc(a, sizeof *ad)) == NULL) return NULL;
+    ad->p = p;
+    ad->next = a->adopted;
+    a->adopted = ad;
+    return p;
+}
+
+
+static inline ularenamark ularena_mark(const ularena *a) {
+    ularenamark m = { NULL, 0, NULL };
+    if (a) {
+        m.chunk   = a->cur;
+        m.used    = a->cur ? a->cur->used : 0;
+        m.adopted = a->adopted;
+    }
+    return m;
+}
+
+
+static inline void ularena_rewind(ularena *a, ularenamark m) {
+    if (!a) return;
+
+    while (a->adopted && a->adopted != m.adopted) {
+        (free)(a->adopted->p);
+        a->adopted = a->adopted->next;
+    }
+
+    while (a->cur && a->cur != m.chunk) {
+        ul__arenachunk *c = a->cur;
+        a->cur = c->prev;
+        c->prev = a->spare;
+        a->spare = c;
+    }
+    if (a->cur) a->cur->used = m.used;
+}
+
+
+static inline void ularena_reset(ularena *a) {
+    ularena_rewind(a, (ularenamark){ NULL, 0, NULL });
+}
+
+
+static inline void ularena_destroy(ularena *a) {
+    if (!a) return;
+    ularena_reset(a);
+    while (a->spare) {
+        ul__arenachunk *c = a->spare;
+        a->spare = c->prev;
+        (free)(c);
+    }
+    (free)(a);
+}
+
+
+
+// Scoped temporary strings
+// ------------------------
+// Each thread has a temporary arena. Between ultmp_begin() and the matching
+// ultmp_end(), ulautostr() adopts heap strings into it, of any length and
+// without copying. Any number of them may be live at once, and all are
+// freed together when the scope ends. Scopes nest. Outside any scope,
+// ulautostr() keeps only its last ulAUTOSTRKEEP results alive, so several
+// can still appear in one expression. On POSIX systems a thread's arena and
+// kept strings are freed when the thread exits.
+
+#ifndef ulAUTOSTRKEEP
+#define ulAUTOSTRKEEP    16
+#endif
+
+ulSHARED _Thread_local ularena *ul__tmp_arena;
+ulSHARED _Thread_local int      ul__tmp_depth;
+ulSHARED _Thread_local char    *ul__tmp_keep[ulAUTOSTRKEEP];
+ulSHARED _Thread_local unsigned ul__tmp_next;
+
+#ifdef ulHAVEPOSIX
+ulSHARED pthread_once_t         ul__tmp_once = PTHREAD_ONCE_INIT;
+ulSHARED pthread_key_t          ul__tmp_key;
+ulSHARED _Thread_local int      ul__tmp_hooked;
+
+static inline void ul__tmp_threadexit(void *arg) {
+    (void)arg;
+    for (unsigned i = 0; i < ulAUTOSTRKEEP; i++) {
+        (free)(ul__tmp_keep[i]);
+        ul__tmp_keep[i] = NULL;
+    }
+    ularena_destroy(ul__tmp_arena);
+    ul__tmp_arena = NULL;
+    ul__tmp_depth = 0;
+}
+
+static inline void ul__tmp_keyinit(void) {
+    pthread_key_create(&ul__tmp_key, ul__tmp_threadexit);
+}
+#endif
+
+// Arrange for this thread's temporaries to be freed when it exits
+static inline void ul__tmp_hook(void) {
+#ifdef ulHAVEPOSIX
+    if (ul__tmp_hooked) return;
+    ul__tmp_hooked = 1;
+    pthread_once(&ul__tmp_once, ul__tmp_keyinit);
+    pthread_setspecific(ul__tmp_key, &ul__tmp_hooked);
+#endif
+}
+
+static inline ularenamark ultmp_begin(void) {
+    if (!ul__tmp_arena) {
+        ul__tmp_arena = ularena_create(4096);
+        ul__tmp_hook();
+    }
+    ul__tmp_depth++;
+    return ularena_mark(ul__tmp_arena);
+}
+
+static inline void ultmp_end(ularenamark m) {
+    ularena_rewind(ul__tmp_arena, m);
+    if (ul__tmp_depth > 0) ul__tmp_depth--;
+}
+
+
+
+
+
+
+
+
+
+
+//===========================================================================
+//                              String functions
+//===========================================================================
+#define ul__stridxnomatch(...)       strspn(__VA_ARGS__)
+#define ul__stridxmatch(...)         strcspn(__VA_ARGS__)
+#define ul__strcharfirstptr(...)     strchr(__VA_ARGS__)
+#define ul__strcharlastptr(...)      strrchr(__VA_ARGS__)
+#define ul__strstrfirstptr(...)      ulstrstrfirstptr(__VA_ARGS__)
+#define ul__strstrlastptr(...)       ulstrstrlastptr(__VA_ARGS__)
+#define ulstridxnomatch(...)         ul__stridxnomatch(__VA_ARGS__)
+#define ulstridxmatch(...)           ul__stridxmatch(__VA_ARGS__)
+#define ulstrcharfirstptr(...)       ul__strcharfirstptr(__VA_ARGS__)
+#define ulstrcharlastptr(...)        ul__strcharlastptr(__VA_ARGS__)
+
+
+// Substring Search
+// ----------------
+// ulstrstrfirstptr(h, n) and ulstrstrlastptr(h, n) return a pointer to the
+// first or last occurrence of n in h, or NULL. An empty needle matches at
+// the start (first) or at the terminating NUL (last). The ulmemstr* forms
+// take explicit lengths, need no terminators, and skip the strlen() passes.
+// ulstrstrfirstptr() never measures the whole haystack: it finds the end in
+// doubling windows (from ulSTRSEARCHWINDOW bytes) and searches each as it
+// goes, so an early match costs time proportional to its position.
+//
+// Needles up to ulSTRSEARCHSHORT bytes use a first/last-byte filter: a block
+// of 16 or 32 candidate positions is tested at once against the needle's
+// first and last bytes, and only positions matching both are memcmp()ed.
+// Longer needles use Boyer-Moore-Horspool, which skips ahead by up to the
+// needle length per probe. Searching backward mirrors both.
+//
+// To search many haystacks for the same needle, compile it once:
+//
+//     ulstrsearch ss;
+//     ulstrsearch_init(&ss, "needle", 6);
+//     p = ulstrsearch_first(&ss, buf, buflen);
+//
+// ulstrsearch keeps a pointer to the needle, which must outlive it.
+
+#ifndef ulSTRSEARCHSHORT
+#define ulSTRSEARCHSHORT 32
+#endif
+#ifndef ulSTRSEARCHWINDOW
+#define ulSTRSEARCHWINDOW 256
+#endif
+
+typedef struct ulstrsearch {
+    const char *needle;
+    size_t      len;
+    size_t      skip[256];            // Forward shifts, keyed on last byte
+    size_t      rskip[256];           // Backward shifts, keyed on first byte
+} ulstrsearch;
+
+
+// 1 if the needle (1 <= nn) is at h, given its first and last bytes match
+static inline int ul__strsearch_verify(const char *h, const char *n, size_t nn) {
+    return nn <= 2 || !memcmp(h + 1, n + 1, nn - 2);
+}
+
+
+// Requires 1 <= nn <= hn
+static inline const char *ul__strsearch_filter(const char *h, size_t hn,
+                                               const char *n, size_t nn) {
+    size_t i = 0, end = hn - nn + 1;  // Candidate starts are [0, end)
+
+#ifdef ulHAVEAVX2
+    {
+        __m256i f = _mm256_set1_epi8(n[0]);
+        __m256i l = _mm256_set1_epi8(n[nn - 1]);
+        for (; i + 32 <= end; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(h + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(h + i + nn - 1));
+            uint32_t m = (uint32_t)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+            for (; m; m &= m - 1) {
+                size_t k = i + (size_t)ul__ctz32(m);
+                if (ul__strsearch_verify(h + k, n, nn)) return h + k;
+            }
+        }
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    {
+        __m128i f = _mm_set1_epi8(n[0]);
+        __m128i l = _mm_set1_epi8(n[nn - 1]);
+        for (; i + 16 <= end; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(h + i + nn - 1));
+            uint32_t m = (uint32_t)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+            for (; m; m &= m - 1) {
+                size_t k = i + (size_t)ul__ctz32(m);
+                if (ul__strsearch_verify(h + k, n, nn)) return h + k;
+            }
+        }
+    }
+#endif
+
+    for (; i < end; i++) {
+        if (h[i] == n[0] && h[i + nn - 1] == n[nn - 1] &&
+            ul__strsearch_verify(h + i, n, nn)) return h + i;
+    }
+
+    return NULL;
+}
+
+
+// Requires 1 <= nn <= hn
+static inline const char *ul__strsearch_rfilter(const char *h, size_t hn,
+                                                const char *n, size_t nn) {
+    size_t end = hn - nn + 1;         // Unsearched candidate starts are [0, end)
+
+#ifdef ulHAVEAVX2
+    {
+        __m256i f = _mm256_set1_epi8(n[0]);
+        __m256i l = _mm256_set1_epi8(n[nn - 1]);
+        for (; end >= 32; end -= 32) {
+            const char *p = h + end - 32;
+            __m256i a = _mm256_loadu_si256((const __m256i *)p);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(p + nn - 1));
+            uint32_t m = (uint32_t)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+            while (m) {
+                int k = ul__msb32(m);
+                if (ul__strsearch_verify(p + k, n, nn)) return p + k;
+                m &= ~(1U << k);
+            }
+        }
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    {
+        __m128i f = _mm_set1_epi8(n[0]);
+        __m128i l = _mm_set1_epi8(n[nn - 1]);
+        for (; end >= 16; end -= 16) {
+            const char *p = h + end - 16;
+            __m128i a = _mm_loadu_si128((const __m128i *)p);
+            __m128i b = _mm_loadu_si128((const __m128i *)(p + nn - 1));
+            uint32_t m = (uint32_t)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+            while (m) {
+                int k = ul__msb32(m);
+                if (ul__strsearch_verify(p + k, n, nn)) return p + k;
+                m &= ~(1U << k);
+            }
+        }
+    }
+#endif
+
+    while (end-- > 0) {
+        if (h[end] == n[0] && h[end + nn - 1] == n[nn - 1] &&
+            ul__strsearch_verify(h + end, n, nn)) return h + end;
+    }
+
+    return NULL;
+}
+
+
+static inline void ul__strsearch_tables(ulstrsearch *ss) {
+    const unsigned char *n = (const unsigned char *)ss->needle;
+    size_t nn = ss->len, k;
+
+    for (k = 0; k < 256; k++) ss->skip[k] = ss->rskip[k] = nn;
+    for (k = 0; k + 1 < nn; k++) ss->skip[n[k]] = nn - 1 - k;
+    for (k = nn - 1; k > 0; k--) ss->rskip[n[k]] = k;
+}
+
+
+// Boyer-Moore-Horspool. Requires 2 <= nn <= hn
+static inline const char *ul__strsearch_bmh(const ulstrsearch *ss,
+                                            const char *h, size_t hn) {
+    const char *n = ss->needle;
+    size_t nn = ss->len, i = 0, last = hn - nn;
+
+    for (;;) {
+        unsigned char c = (unsigned char)h[i + nn - 1];
+        if (c == (unsigned char)n[nn - 1] && !memcmp(h + i, n, nn - 1)) return h + i;
+        if (last - i < ss->skip[c]) return NULL;
+        i += ss->skip[c];
+    }
+}
+
+
+// Mirror image: the window moves left, keyed on its first byte
+static inline const char *ul__strsearch_rbmh(const ulstrsearch *ss,
+                                             const char *h, size_t hn) {
+    const char *n = ss->needle;
+    size_t nn = ss->len, i = hn - nn;
+
+    for (;;) {
+        unsigned char c = (unsigned char)h[i];
+        if (c == (unsigned char)n[0] && !memcmp(h + i + 1, n + 1, nn - 1)) return h + i;
+        if (i < ss->rskip[c]) return NULL;
+        i -= ss->rskip[c];
+    }
+}
+
+
+static inline void ulstrsearch_init(ulstrsearch *ss, const char *needle, size_t len) {
+    ss->needle = needle;
+    ss->len = len;
+    if (len > ulSTRSEARCHSHORT) ul__strsearch_tables(ss);
+}
+
+
+static inline char *ulstrsearch_first(const ulstrsearch *ss, const char *h, size_t hn) {
+    if (ss->len == 0) return (char *)h;
+    if (ss->len > hn) return NULL;
+    if (ss->len == 1) return memchr(h, ss->needle[0], hn);
+    if (ss->len <= ulSTRSEARCHSHORT)
+        return (char *)ul__strsearch_filter(h, hn, ss->needle, ss->len);
+    return (char *)ul__strsearch_bmh(ss, h, hn);
+}
+
+
+static inline char *ulstrsearch_last(const ulstrsearch *ss, const char *h, size_t hn) {
+    if (ss->len == 0) return (char *)h + hn;
+    if (ss->len > hn) return NULL;
+    if (ss->len <= ulSTRSEARCHSHORT)
+        return (char *)ul__strsearch_rfilter(h, hn, ss->needle, ss->len);
+    return (char *)ul__strsearch_rbmh(ss, h, hn);
+}
+
+
+static inline char *ulmemstrfirstptr(const char *h, size_t hn, const char *n, size_t nn) {
+    ulstrsearch ss;
+
+    if (nn == 0) return (char *)h;
+    if (nn > hn) return NULL;
+    if (nn == 1) return memchr(h, n[0], hn);
+    if (nn <= ulSTRSEARCHSHORT) return (char *)ul__strsearch_filter(h, hn, n, nn);
+
+    ulstrsearch_init(&ss, n, nn);
+    return (char *)ul__strsearch_bmh(&ss, h, hn);
+}
+
+
+static inline char *ulmemstrlastptr(const char *h, size_t hn, const char *n, size_t nn) {
+    ulstrsearch ss;
+
+    if (nn == 0) return (char *)h + hn;
+    if (nn > hn) return NULL;
+    if (nn <= ulSTRSEARCHSHORT) return (char *)ul__strsearch_rfilter(h, hn, n, nn);
+
+    ulstrsearch_init(&ss, n, nn);
+    return (char *)ul__strsearch_rbmh(&ss, h, hn);
+}
+
+
+static inline char *ulstrstrfirstptr(const char *h, const char *n) {
+    size_t nn = strlen(n), win, len;
+    const char *z, *r, *start = h;
+    ulstrsearch ss;
+    int built = 0;
+
+    if (nn == 0) return (char *)h;
+    if (nn == 1) return strchr(h, n[0]);
+
+    // Consecutive windows overlap by nn - 1 bytes so no match straddles two.
+    // A long needle's skip table is only built if the first window misses.
+    win = nn < ulSTRSEARCHWINDOW / 4 ? ulSTRSEARCHWINDOW : 4 * nn;
+    for (;;) {
+        z   = memchr(h, '\0', win);
+        len = z ? (size_t)(z - h) : win;
+        if (len < nn) return NULL;
+
+        if (nn <= ulSTRSEARCHSHORT || h == start) {
+            r = ul__strsearch_filter(h, len, n, nn);
+        }
+        else {
+            if (!built++) ulstrsearch_init(&ss, n, nn);
+            r = ul__strsearch_bmh(&ss, h, len);
+        }
+        if (r || z) return (char *)r;
+
+        h += len - (nn - 1);
+        if (win < ((size_t)1 << 20)) win *= 2;
+    }
+}
+
+
+static inline char *ulstrstrlastptr(const char *h, const char *n) {
+    return ulmemstrlastptr(h, strlen(h), n, strlen(n));
+}
+
+
+
+// Byte Sets
+// ---------
+// A ulbyteset is built once from a set of bytes and then answers the same
+// questions as strspn()/strcspn() without rebuilding a table on every call:
+//
+//     ulbyteset ws;
+//     ulbyteset_init(&ws, " \t\r\n");
+//     n = ulbyteset_span(&ws, s);              // Like strspn(s, " \t\r\n")
+//     p = ulbyteset_firstn(&ws, buf, len);     // First member, or NULL
+//
+// ulBYTESET("literal") yields a const pointer to the set of a literal's
+// bytes. C has no portable way to compute the tables from a literal at
+// compile time, so they are built at run time: with GCC or Clang, once per
+// call site on its first use (other threads arriving meanwhile wait), and
+// elsewhere into a compound literal each time the macro is evaluated, valid
+// until the enclosing block ends.
+//
+// The functions ending in n take a length, stop only at the end of input,
+// and test 16 or 32 bytes at a time with a nibble-shuffle lookup (SSSE3 or
+// AVX2), or a 256-bit bitmap otherwise. The NUL-terminated forms never treat
+// '\0' as a member and use the bitmap.
+//
+// ulbytesplit walks the fields of a buffer separated by any member of a set.
+// Adjacent delimiters produce empty fields, as with strsep().
+
+typedef struct ulbyteset {
+    uint8_t bits[32];                 // Bit c%8 of bits[c/8] set if c is a member
+    uint8_t lo[16];                   // Bit c/16 of lo[c%16], members below 0x80
+    uint8_t hi[16];                   // Bit c/16-8 of hi[c%16], members 0x80 up
+} ulbyteset;
+
+typedef struct ulbytesplit {
+    const ulbyteset *set;
+    const char      *p;
+    const char      *end;             // NULL once the last field is returned
+} ulbytesplit;
+
+
+static inline int ulbyteset_has(const ulbyteset *set, unsigned char c) {
+    return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+
+static inline void ulbyteset_initn(ulbyteset *set, const char *chars, size_t n) {
+    memset(set, 0, sizeof *set);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        set->bits[c >> 3] |= (uint8_t)(1U << (c & 7));
+        if (c < 0x80) set->lo[c & 15] |= (uint8_t)(1U << (c >> 4));
+        else          set->hi[c & 15] |= (uint8_t)(1U << ((c >> 4) - 8));
+    }
+}
+
+
+static inline void ulbyteset_init(ulbyteset *set, const char *chars) {
+    ulbyteset_initn(set, chars, strlen(chars));
+}
+
+
+#if defined( __GNUC__ )
+#define ulBYTESET(lit) (__extension__({                                        \
+    static ulbyteset ul__bs;                                                   \
+    static _Atomic int ul__bs_state;                                           \
+    int ul__bs_s = atomic_load_explicit(&ul__bs_state, memory_order_acquire);  \
+    if (ul__bs_s != 2) ul__byteset_once(&ul__bs, &ul__bs_state, "" lit,        \
+                                        sizeof(lit) - 1);                      \
+    (const ulbyteset *)&ul__bs; }))
+#else
+#define ulBYTESET(lit) \
+    ul__byteset_make(&(ulbyteset){ 0 }, "" lit, sizeof(lit) - 1)
+#endif
+
+static inline const ulbyteset *ul__byteset_make(ulbyteset *set,
+                                                const char *chars, size_t n) {
+    ulbyteset_initn(set, chars, n);
+    return set;
+}
+
+static inline void ul__byteset_once(ulbyteset *set, _Atomic int *state,
+                                    const char *chars, size_t n) {
+    int expect = 0;
+    if (atomic_compare_exchange_strong_explicit(state, &expect, 1,
+            memory_order_acquire, memory_order_acquire)) {
+        ulbyteset_initn(set, chars, n);
+        atomic_store_explicit(state, 2, memory_order_release);
+    }
+    else while (atomic_load_explicit(state, memory_order_acquire) != 2);
+}
+
+
+// Membership masks for 32 or 16 bytes. Each byte's low nibble selects a row
+// from lo/hi (by the byte's top bit), and its high nibble selects the bit.
+#ifdef ulHAVEAVX2
+typedef struct ul__bsv32 { __m256i lo, hi, pow, nib; } ul__bsv32;
+
+static inline ul__bsv32 ul__byteset_v32(const ulbyteset *set) {
+    ul__bsv32 t;
+    t.lo  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo));
+    t.hi  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hi));
+    t.pow = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                      1, 2, 4, 8, 16, 32, 64, -128));
+    t.nib = _mm256_set1_epi8(0x0F);
+    return t;
+}
+
+static inline uint32_t ul__byteset_m32(const ul__bsv32 *t, const char *p) {
+    __m256i v   = _mm256_loadu_si256((const __m256i *)p);
+    __m256i lo  = _mm256_and_si256(v, t->nib);
+    __m256i hi  = _mm256_and_si256(_mm256_srli_epi16(v, 4), t->nib);
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(t->lo, lo),
+                                     _mm256_shuffle_epi8(t->hi, lo), v);
+    __m256i bit = _mm256_shuffle_epi8(t->pow, hi);
+    return (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+}
+#endif
+
+#ifdef ulHAVESSSE3
+typedef struct ul__bsv16 { __m128i lo, hi, pow, nib; } ul__bsv16;
+
+static inline ul__bsv16 ul__byteset_v16(const ulbyteset *set) {
+    ul__bsv16 t;
+    t.lo  = _mm_loadu_si128((const __m128i *)set->lo);
+    t.hi  = _mm_loadu_si128((const __m128i *)set->hi);
+    t.pow = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    t.nib = _mm_set1_epi8(0x0F);
+    return t;
+}
+
+static inline uint32_t ul__byteset_m16(const ul__bsv16 *t, const char *p) {
+    __m128i v   = _mm_loadu_si128((const __m128i *)p);
+    __m128i lo  = _mm_and_si128(v, t->nib);
+    __m128i hi  = _mm_and_si128(_mm_srli_epi16(v, 4), t->nib);
+    __m128i top = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    __m128i row = _mm_or_si128(_mm_and_si128(top, _mm_shuffle_epi8(t->hi, lo)),
+                               _mm_andnot_si128(top, _mm_shuffle_epi8(t->lo, lo)));
+    __m128i bit = _mm_shuffle_epi8(t->pow, hi);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+}
+#endif
+
+
+// Index of the first byte of s[0, n) whose membership equals want, or n
+static inline size_t ul__byteset_scan(const ulbyteset *set, const char *s,
+                                      size_t n, int want) {
+    size_t i = 0;
+
+#ifdef ulHAVEAVX2
+    if (n >= 32) {
+        ul__bsv32 t = ul__byteset_v32(set);
+        for (; i + 32 <= n; i += 32) {
+            uint32_t m = ul__byteset_m32(&t, s + i);
+            if (!want) m = ~m;
+            if (m) return i + (size_t)ul__ctz32(m);
+        }
+    }
+#endif
+
+#ifdef ulHAVESSSE3
+    if (n - i >= 16) {
+        ul__bsv16 t = ul__byteset_v16(set);
+        for (; i + 16 <= n; i += 16) {
+            uint32_t m = ul__byteset_m16(&t, s + i);
+            if (!want) m = ~m & 0xFFFFU;
+            if (m) return i + (size_t)ul__ctz32(m);
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (ulbyteset_has(set, (unsigned char)s[i]) == want) return i;
+    }
+    return n;
+}
+
+
+// Index of the last byte of s[0, n) whose membership equals want, or n
+static inline size_t ul__byteset_rscan(const ulbyteset *set, const char *s,
+                                       size_t n, int want) {
+    size_t end = n;
+
+#ifdef ulHAVEAVX2
+    if (end >= 32) {
+        ul__bsv32 t = ul__byteset_v32(set);
+        for (; end >= 32; end -= 32) {
+            uint32_t m = ul__byteset_m32(&t, s + end - 32);
+            if (!want) m = ~m;
+            if (m) return end - 32 + (size_t)ul__msb32(m);
+        }
+    }
+#endif
+
+#ifdef ulHAVESSSE3
+    if (end >= 16) {
+        ul__bsv16 t = ul__byteset_v16(set);
+        for (; end >= 16; end -= 16) {
+            uint32_t m = ul__byteset_m16(&t, s + end - 16);
+            if (!want) m = ~m & 0xFFFFU;
+            if (m) return end - 16 + (size_t)ul__msb32(m);
+        }
+    }
+#endif
+
+    while (end-- > 0) {
+        if (ulbyteset_has(set, (unsigned char)s[end]) == want) return end;
+    }
+    return n;
+}
+
+
+static inline size_t ulbyteset_spann(const ulbyteset *set, const char *s, size_t n) {
+    return ul__byteset_scan(set, s, n, 0);
+}
+
+
+static inline size_t ulbyteset_cspann(const ulbyteset *set, const char *s, size_t n) {
+    return ul__byteset_scan(set, s, n, 1);
+}
+
+
+static inline char *ulbyteset_firstn(const ulbyteset *set, const char *s, size_t n) {
+    size_t i = ul__byteset_scan(set, s, n, 1);
+    return i < n ? (char *)s + i : NULL;
+}
+
+
+static inline char *ulbyteset_lastn(const ulbyteset *set, const char *s, size_t n) {
+    size_t i = ul__byteset_rscan(set, s, n, 1);
+    return i < n ? (char *)s + i : NULL;
+}
+
+
+static inline size_t ulbyteset_span(const ulbyteset *set, const char *s) {
+    size_t i = 0;
+    while (s[i] && ulbyteset_has(set, (unsigned char)s[i])) i++;
+    return i;
+}
+
+
+static inline size_t ulbyteset_cspan(const ulbyteset *set, const char *s) {
+    size_t i = 0;
+    while (s[i] && !ulbyteset_has(set, (unsigned char)s[i])) i++;
+    return i;
+}
+
+
+static inline char *ulbyteset_first(const ulbyteset *set, const char *s) {
+    size_t i = ulbyteset_cspan(set, s);
+    return s[i] ? (char *)s + i : NULL;
+}
+
+
+static inline char *ulbyteset_last(const ulbyteset *set, const char *s) {
+    return ulbyteset_lastn(set, s, strlen(s));
+}
+
+
+static inline void ulbytesplit_init(ulbytesplit *it, const ulbyteset *set,
+                                    const char *s, size_t n) {
+    it->set = set;
+    it->p   = s;
+    it->end = s + n;
+}
+
+
+// Returns 1 and the next field in *field/*len, or 0 when there are no more
+static inline int ulbytesplit_next(ulbytesplit *it, const char **field, size_t *len) {
+    size_t n;
+
+    if (!it->end) return 0;
+
+    n = ul__byteset_scan(it->set, it->p, (size_t)(it->end - it->p), 1);
+    *field = it->p;
+    *len   = n;
+    if (it->p + n == it->end) it->end = NULL;
+    else                      it->p  += n + 1;
+    return 1;
+}
+
+
+
+// Wrap fgets() for standard human input
+// -------------------------------------
+static inline char *ulinputline(char *buf, int n, FILE *fp) {
+    size_t len;
+    int c;
+
+    if (fgets(buf, n, fp) == NULL) return NULL;
+
+    len = strlen(buf);
+    if (len < 1) return buf;             // Go ahead and return empty string
+
+    if (buf[len-1] == '\n') {            // If we got the newline, NUL it
+        buf[len-1] = '\0';
+    } else {                             // If we didn't get the newline
+        while ((c = getc(fp)) != EOF &&  //   Discard the rest of the line
+               c != '\n');               //   from the same stream
+    }
+
+    return buf;
+}
+
+
+
+#ifdef ulHAVEPOSIX
+
+// Buffered line reader
+// --------------------
+// Iterates over the lines of a file descriptor, a FILE*, or a named file.
+// Each call to ullinereader_next() yields a zero-copy view (*line, *len) of
+// the next line, without its '\n' and NOT NUL-terminated. The view points
+// into the reader's own storage: it is valid only until the next call to
+// ullinereader_next() or ullinereader_close(), and must not be written.
+// Returns 1 for a line, 0 at end of input, -1 on a read error.
+//
+// Regular files are mapped with mmap() when possible, so lines are read
+// straight from the page cache. Other inputs are read in large blocks
+// (ulLINEBUFSZ), and the buffer grows to fit arbitrarily long lines.
+// Newlines are found with memchr(), which libc vectorizes. Readers made
+// from an fd or FILE* do not close it. A mapped fd's file offset is not
+// advanced; a FILE* is read with fread() and never mapped.
+
+#ifndef ulLINEBUFSZ
+#define ulLINEBUFSZ      (1 << 20)
+#endif
+
+typedef struct ullinereader {
+    int          fd;                   // -1 when reading through fp
+    FILE        *fp;
+    int          ownfd;
+    int          eof;
+    char        *buf;
+    size_t       cap, start, scan, end;
+    const char  *map;                  // Whole-file mapping, or NULL
+    size_t       maplen;
+} ullinereader;
+
+
+static inline ullinereader *ul__linereader_new(int fd, FILE *fp, int ownfd) {
+    ullinereader *r = calloc(1, sizeof *r);
+    struct stat st;
+
+    if (!r) return NULL;
+    r->fd = fd;
+    r->fp = fp;
+    r->ownfd = ownfd;
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t at = lseek(fd, 0, SEEK_CUR);
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            #ifdef MADV_SEQUENTIAL
+            madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+            #endif
+            r->map = m;
+            r->maplen = (size_t)st.st_size;
+            r->start = at > 0 && (size_t)at < r->maplen ? (size_t)at :
+                       at > 0 ? r->maplen : 0;
+            return r;
+        }
+    }
+
+    if ((r->buf = malloc(ulLINEBUFSZ)) == NULL) { (free)(r); return NULL; }
+    r->cap = ulLINEBUFSZ;
+    return r;
+}
+
+static inline ullinereader *ullinereader_fd(int fd) {
+    return fd < 0 ? NULL : ul__linereader_new(fd, NULL, 0);
+}
+
+static inline ullinereader *ullinereader_file(FILE *fp) {
+    return fp ? ul__linereader_new(-1, fp, 0) : NULL;
+}
+
+static inline ullinereader *ullinereader_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    ullinereader *r;
+    if (fd < 0) return NULL;
+    if ((r = ul__linereader_new(fd, NULL, 1)) == NULL) close(fd);
+    return r;
+}
+
+
+static inline int ullinereader_next(ullinereader *r, const char **line, size_t *len) {
+    const char *nl;
+
+    if (r->map) {
+        if (r->start >= r->maplen) return 0;
+        *line = r->map + r->start;
+        nl = memchr(*line, '\n', r->maplen - r->start);
+        *len = nl ? (size_t)(nl - *line) : r->maplen - r->start;
+        r->start += *len + (nl != NULL);
+        return 1;
+    }
+
+    for (;;) {
+        if ((nl = memchr(r->buf + r->scan, '\n', r->end - r->scan)) != NULL) {
+            *line = r->buf + r->start;
+            *len  = (size_t)(nl - *line);
+            r->start = r->scan = (size_t)(nl - r->buf) + 1;
+            return 1;
+        }
+        r->scan = r->end;
+
+        if (r->eof) {
+            if (r->start == r->end) return 0;
+            *line = r->buf + r->start;
+            *len  = r->end - r->start;
+            r->start = r->end;
+            return 1;
+        }
+
+        // Make room: slide the partial line down, or grow for a long line
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end  -= r->start;
+            r->scan -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) {
+            char *nb = realloc(r->buf, r->cap * 2);
+            if (!nb) return -1;
+            r->buf = nb;
+            r->cap *= 2;
+        }
+
+        if (r->fp) {
+            size_t n = fread(r->buf + r->end, 1, r->cap - r->end, r->fp);
+            if (n == 0) {
+                if (ferror(r->fp)) return -1;
+                r->eof = 1;
+            }
+            r->end += n;
+        }
+        else {
+            ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            if (n == 0) r->eof = 1;
+            r->end += (size_t)n;
+        }
+    }
+}
+
+
+static inline void ullinereader_close(ullinereader *r) {
+    if (!r) return;
+    if (r->map) munmap((void *)r->map, r->maplen);
+    if (r->ownfd) close(r->fd);
+    (free)(r->buf);
+    (free)(r);
+}
+
+#endif
+
+
+
+// Allow quick/dirty auto storage of dynamic strings
+// -------------------------------------------------
+// Takes ownership of s. See "Scoped temporary strings" for its lifetime.
+static inline char *ulautostr(char *s) {
+    if (!s) return NULL;
+    if (ul__tmp_depth > 0 && ul__tmp_arena && ularena_adopt(ul__tmp_arena, s)) return s;
+
+    ul__tmp_hook();
+    (free)(ul__tmp_keep[ul__tmp_next]);
+    ul__tmp_keep[ul__tmp_next] = s;
+    ul__tmp_next = (ul__tmp_next + 1) % ulAUTOSTRKEEP;
+    return s;
+}
+
+
+
+// Quick/dirty strdup() for non-POSIX systems
+// ------------------------------------------
+static inline char *ulstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *r = malloc(n+1);
+    if (r) { memcpy(r, s, n); r[n] = '\0'; }
+    return r;
+}
+
+
+// Limited UTF-8 and UTF-16 Conversion Functions
+// ---------------------------------------------
+// ulcdpt_from_utf8() is lenient: an invalid sequence yields its first byte.
+// Check untrusted input with ulutf8_validate() first.
+
+static inline int32_t ulcdpt_from_utf8(const unsigned char *s) {
+    if (s[0] <= 0x7F) return s[0];
+
+    if ((0xC0 <= s[0] && s[0] <= 0xDF) &&     //  1100 0000 —— 1101 1111
+        (0x80 <= s[1] && s[1] <= 0xBF))       //  1000 0000 —— 1011 1111
+            return ((s[0] & 0x1F) <<  6) |         // 000xxxxx______
+                   ((s[1] & 0x3F) <<  0) ;         //       00xxxxxx
+
+    if ((0xE0 <= s[0] && s[0] <= 0xEF) &&     //  1110 0000 —— 1110 1111
+        (0x80 <= s[1] && s[1] <= 0xBF) &&     //  1000 0000 —— 1011 1111
+        (0x80 <= s[2] && s[2] <= 0xBF))       //  1000 0000 —— 1011 1111
+            return ((s[0] & 0x0F) << 12) |         // xxxx____________
+                   ((s[1] & 0x3F) <<  6) |         //   00xxxxxx______
+                   ((s[2] & 0x3F) <<  0) ;         //         00xxxxxx
+
+    if ((0xF0 <= s[0] && s[0] <= 0xF7) &&     //  1111 0000 —— 1111 0111
+        (0x80 <= s[1] && s[1] <= 0xBF) &&     //  1000 0000 —— 1011 1111
+        (0x80 <= s[2] && s[2] <= 0xBF) &&     //  1000 0000 —— 1011 1111
+        (0x80 <= s[3] && s[3] <= 0xBF))       //  1000 0000 —— 1011 1111
+            return ((s[0] & 0x07) << 18) |         // xxx__________________
+                   ((s[1] & 0x3F) << 12) |         //  00xxxxxx____________
+                   ((s[2] & 0x3F) <<  6) |         //        00xxxxxx______
+                   ((s[3] & 0x3F) <<  0) ;         //              00xxxxxx
+
+    /* Default -- maybe it isn't UTF-8? */
+    return s[0];
+}
+
+
+static inline int32_t ulcdpt_from_utf16(uint16_t hi, uint16_t lo) {
+    if (0xD800 <= hi && hi <= 0xDBFF) {
+        if (0xDC00 <= lo && lo <= 0xDFFF) {
+            // We have a valid surrogate pair, so convert it.
+            // Unicode 15.0, Tbl 3-5 says UTF-16 surrogate pairs in form:
+            //         110110wwwwyyyyyy
+            //                   110111xxxxxxxxxx
+            // map to scalar code points of value:
+            //              uuuuuyyyyyyxxxxxxxxxx     (uuuuu=wwww+1)
+            return ((lo & 0x03FF)        |
+                   ((hi & 0x003F) << 10) |
+                   ((hi & 0x03C0) << 10) +
+                   ((     0x0040) << 10));
+        }
+    }
+    else if (!(0xDC00 <= lo && lo <= 0xDFFF)) {
+        return lo;
+    }
+
+    return '?';
+}
+
+
+static inline void ulutf16_from_cdpt(int32_t cdpt, uint16_t *hi, uint16_t *lo) {
+    if (0 <= cdpt && cdpt <= 65535) {
+        *hi = 0;
+        *lo = (uint16_t)cdpt;
+        return;
+    }
+
+    else {
+        *lo = 0xDC00 | (cdpt & 0x03FF);
+        *hi = (uint16_t)(cdpt >> 10);
+        *hi = *hi - (1<<6);
+        *hi = *hi | 0xD800;
+        return;
+    }
+}
+
+
+// Reentrant UTF-8 Encoding
+// ------------------------
+// ulutf8_from_cdpt_r() encodes one code point into a caller-provided buffer
+// and returns the number of bytes written, or 0 if c is not a Unicode scalar
+// value or does not fit in cap bytes. No NUL terminator is written.
+//
+// ulutf8_from_cdpts() serializes an array of code points in one pass. It
+// first sizes the output, so every code point that fits is encoded without
+// per-character bounds checks, using a branch-light store of up to four
+// bytes. It stops at the first invalid code point or when out is full.
+// ulutf8_size_from_cdpts() reports how many bytes the whole array needs.
+
+typedef struct ulutfresult {
+    size_t nread;                      // Input units consumed
+    size_t nwritten;                   // Output units produced
+} ulutfresult;
+
+
+// Encode a valid scalar value as UTF-8 into d. Returns the byte count.
+static inline int ul__utf8_encode1(int32_t c, unsigned char *d) {
+    if (c < 0x80) {                    // Up to 7 bits
+        d[0]= (unsigned char)(c>>0   & 0x7F);        // 7 bits –> 0xxxxxxx
+        return 1;
+    }
+    if (c < 0x800) {                   // Up to 11 bits
+        d[0]= (unsigned char)((c>>6  & 0x1F)|0xC0);  // 5 bits –> 110xxxxx
+        d[1]= (unsigned char)((c     & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
+        return 2;
+    }
+    if (c < 0x10000) {                 // Up to 16 bits
+        d[0]= (unsigned char)((c>>12 & 0x0F)|0xE0);  // 4 bits –> 1110xxxx
+        d[1]= (unsigned char)((c>>6  & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
+        d[2]= (unsigned char)((c     & 0x3F)|0x80);  // 6 bits –> 10xxxxxx
+        return 3;
+    }
+    d[0]= (unsigned char)((c>>18 & 0x07)|0xF0);      // 3 bits –> 11110xxx
+    d[1]= (unsigned char)((c>>12 & 0x3F)|0x80);      // 6 bits –> 10xxxxxx
+    d[2]= (unsigned char)((c>>6  & 0x3F)|0x80);      // 6 bits –> 10xxxxxx
+    d[3]= (unsigned char)((c     & 0x3F)|0x80);      // 6 bits –> 10xxxxxx
+    return 4;
+}
+
+
+
+static inline int ul__cdpt_valid(int32_t c) {
+    return (uint32_t)c <= 0x10FFFF && ((uint32_t)c & 0xFFFFF800) != 0xD800;
+}
+
+static inline int ul__utf8_len1(int32_t c) {
+    return 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+}
+
+// Store the len-byte encoding of c at d, always touching four bytes. Bytes
+// past len are junk for the next code point to overwrite.
+static inline void ul__utf8_put4(int32_t c, int len, unsigned char *d) {
+    static const unsigned char lead[5] = { 0, 0x00, 0xC0, 0xE0, 0xF0 };
+    uint32_t u = (uint32_t)c;
+    unsigned sh = 6U * (unsigned)(len - 1);
+    d[0] = (unsigned char)((u >> sh) | lead[len]);
+    d[1] = (unsigned char)(((u >> ((sh -  6) & 31)) & 0x3F) | 0x80);
+    d[2] = (unsigned char)(((u >> ((sh - 12) & 31)) & 0x3F) | 0x80);
+    d[3] = (unsigned char)(((u >> ((sh - 18) & 31)) & 0x3F) | 0x80);
+}
+
+
+static inline size_t ulutf8_from_cdpt_r(int32_t c, unsigned char *out, size_t cap) {
+    if (!ul__cdpt_valid(c) || cap < (size_t)ul__utf8_len1(c)) return 0;
+    return (size_t)ul__utf8_encode1(c, out);
+}
+
+
+static inline size_t ulutf8_size_from_cdpts(const int32_t *src, size_t n) {
+    size_t z = 0;
+    for (size_t i = 0; i < n && ul__cdpt_valid(src[i]); i++) {
+        z += (size_t)ul__utf8_len1(src[i]);
+    }
+    return z;
+}
+
+
+static inline ulutfresult ulutf8_from_cdpts(const int32_t *src, size_t n,
+                                            unsigned char *out, size_t cap) {
+    size_t k, z = 0, o = 0, i = 0;
+
+    // Size pass: how many code points are valid and fit
+    for (k = 0; k < n && ul__cdpt_valid(src[k]); k++) {
+        size_t len = (size_t)ul__utf8_len1(src[k]);
+        if (z + len > cap) break;
+        z += len;
+    }
+
+    // Encode pass: four-byte stores while there is slack, then exact copies
+    for ( ; i < k && o + 4 <= cap; i++) {
+        int len = ul__utf8_len1(src[i]);
+        ul__utf8_put4(src[i], len, out + o);
+        o += (size_t)len;
+    }
+    for ( ; i < k; i++) {
+        o += (size_t)ul__utf8_encode1(src[i], out + o);
+    }
+
+    return (ulutfresult){ k, o };
+}
+
+
+static inline unsigned char *ulutf8_from_cdpt(int32_t c) {
+    _Thread_local static unsigned char u[5];
+    u[ulutf8_from_cdpt_r(c, u, 4)] = '\0';
+    return u;
+}
+
+
+
+// Bulk UTF-8 Decoding
+// -------------------
+// ulcdpts_from_utf8() validates and decodes up to len bytes of src into at
+// most dstcap code points. Unlike ulcdpt_from_utf8(), decoding is strict:
+// overlong forms, surrogates, and values past U+10FFFF are rejected. It
+// stops at the end of input, when dst is full, or at the first invalid or
+// truncated sequence, and reports how far it got so callers can resume at
+// src + nread. Runs of ASCII are widened 16 or 32 bytes at a time.
+
+// Decode one UTF-8 sequence of at most n bytes. Returns its length, or 0 if
+// the sequence is invalid or runs past the end of the input.
+static inline int ul__utf8_decode1(const unsigned char *s, size_t n, int32_t *c) {
+    unsigned char b = s[0];
+
+    if (b <= 0x7F) { *c = b; return 1; }
+
+    if (b <= 0xC1) return 0;                   // Stray continuation/overlong
+
+    if (b <= 0xDF) {                           // 110xxxxx 10xxxxxx
+        if (n < 2 || (s[1] & 0xC0) != 0x80) return 0;
+        *c = ((b & 0x1F) << 6) | (s[1] & 0x3F);
+        return 2;
+    }
+
+    if (b <= 0xEF) {                           // 1110xxxx 10xxxxxx 10xxxxxx
+        if (n < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80) return 0;
+        if (b == 0xE0 && s[1] < 0xA0) return 0;        // Overlong
+        if (b == 0xED && s[1] > 0x9F) return 0;        // Surrogate
+        *c = ((b & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        return 3;
+    }
+
+    if (b <= 0xF4) {                           // 11110xxx 10xxxxxx (x3)
+        if (n < 4 || (s[1] & 0xC0) != 0x80 ||
+                     (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80) return 0;
+        if (b == 0xF0 && s[1] < 0x90) return 0;        // Overlong
+        if (b == 0xF4 && s[1] > 0x8F) return 0;        // Past U+10FFFF
+        *c = ((b & 0x07) << 18) | ((s[1] & 0x3F) << 12) |
+             ((s[2] & 0x3F) <<  6) | (s[3] & 0x3F);
+        return 4;
+    }
+
+    return 0;
+}
+
+
+// Widen a run of ASCII bytes into code points. Returns the run length.
+static inline size_t ul__ascii_widen(const unsigned char *s, size_t n,
+                                     int32_t *d, size_t cap) {
+    size_t i = 0;
+    if (cap < n) n = cap;
+
+#ifdef ulHAVEAVX2
+    while (i + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (_mm256_movemask_epi8(v)) break;
+        for (int k = 0; k < 32; k += 8) {
+            __m128i b = _mm_loadl_epi64((const __m128i *)(s + i + k));
+            _mm256_storeu_si256((__m256i *)(d + i + k), _mm256_cvtepu8_epi32(b));
+        }
+        i += 32;
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(v)) break;
+        __m128i z  = _mm_setzero_si128();
+        __m128i lo = _mm_unpacklo_epi8(v, z);
+        __m128i hi = _mm_unpackhi_epi8(v, z);
+        _mm_storeu_si128((__m128i *)(d + i +  0), _mm_unpacklo_epi16(lo, z));
+        _mm_storeu_si128((__m128i *)(d + i +  4), _mm_unpackhi_epi16(lo, z));
+        _mm_storeu_si128((__m128i *)(d + i +  8), _mm_unpacklo_epi16(hi, z));
+        _mm_storeu_si128((__m128i *)(d + i + 12), _mm_unpackhi_epi16(hi, z));
+        i += 16;
+    }
+#endif
+
+    while (i < n && s[i] <= 0x7F) {
+        d[i] = s[i];
+        i++;
+    }
+
+    return i;
+}
+
+
+static inline ulutfresult ulcdpts_from_utf8(const unsigned char *src, size_t len,
+                                            int32_t *dst, size_t dstcap) {
+    size_t i = 0, o = 0;
+    int32_t c;
+    int n;
+
+    while (i < len && o < dstcap) {
+        if (src[i] <= 0x7F) {
+            size_t run = ul__ascii_widen(src + i, len - i, dst + o, dstcap - o);
+            i += run;
+            o += run;
+            continue;
+        }
+        if ((n = ul__utf8_decode1(src + i, len - i, &c)) == 0) break;
+        dst[o++] = c;
+        i += (size_t)n;
+    }
+
+    return (ulutfresult){ i, o };
+}
+
+
+
+// UTF-8 Validation, Counting, and Indexing
+// ----------------------------------------
+// ulutf8_validate() checks s[0, n) strictly, by the same rules as
+// ulcdpts_from_utf8(), and returns the offset of the first invalid or
+// truncated sequence, or n if the whole buffer is valid. ulcdpt_from_utf8()
+// does no such checking, so validate untrusted input before decoding it.
+// With SSSE3 or AVX2, each block of 16 or 32 bytes is checked with three
+// nibble lookups (Keiser and Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte"). ASCII blocks are skipped with one test, and a
+// failing block is rescanned one sequence at a time to find the offset.
+//
+// ulutf8_count() returns the number of code points in valid UTF-8, and
+// ulutf8_offset() the byte offset of code point k (n if there are fewer),
+// by counting the bytes that are not continuation bytes, a block at a time.
+//
+// For repeated random access, ulutf8index_create() samples the offset of
+// every stride-th code point (ulUTF8INDEXSTRIDE if stride is 0) in one pass.
+// Then ulutf8index_offset() starts from the nearest sample and scans at
+// most stride code points. The index refers to s and does not copy it, and
+// it assumes s is valid. Free it with ulutf8index_destroy().
+
+#ifndef ulUTF8INDEXSTRIDE
+#define ulUTF8INDEXSTRIDE 256
+#endif
+
+typedef struct ulutf8index {
+    const unsigned char *s;
+    size_t               n;            // Bytes in s
+    size_t               ncdpts;       // Code points in s
+    size_t               stride;       // Code points between samples
+    size_t               off[];        // off[j] is where code point j*stride starts
+} ulutf8index;
+
+
+// Length of the run of ASCII bytes at the start of s[0, n)
+static inline size_t ul__ascii_span(const unsigned char *s, size_t n) {
+    size_t i = 0;
+
+#ifdef ulHAVESSE2
+    for (; n - i >= 16; i += 16) {
+        int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+        if (m) return i + (size_t)ul__ctz32((uint32_t)m);
+    }
+#endif
+
+    while (i < n && s[i] <= 0x7F) i++;
+    return i;
+}
+
+
+// Start of the sequence that runs across offset i, given that s[0, i) has
+// been checked up to its last three bytes; otherwise i
+static inline size_t ul__utf8_syncback(const unsigned char *s, size_t i) {
+    for (size_t k = 1; k <= 3 && k <= i; k++) {
+        unsigned char b = s[i - k];
+        if ((b & 0xC0) == 0x80) continue;
+        if (b >= 0xC0 && (size_t)(b >= 0xF0 ? 4 : b >= 0xE0 ? 3 : 2) > k) return i - k;
+        break;
+    }
+    return i;
+}
+
+
+#if defined( ulHAVESSSE3 ) || defined( ulHAVEAVX2 )
+
+// Error classes for a pair of adjacent bytes. A pair is invalid when the
+// classes looked up from the first byte's high nibble, its low nibble, and
+// the second byte's high nibble have a bit in common.
+enum {
+    ul__U8SHORT  = 0x01,               // Lead not followed by continuation
+    ul__U8LONG   = 0x02,               // ASCII followed by continuation
+    ul__U8OVER3  = 0x04,               // E0 80..9F
+    ul__U8LARGE  = 0x08,               // F4 90..BF, F5..FF 90..BF
+    ul__U8SURR   = 0x10,               // ED A0..BF
+    ul__U8OVER2  = 0x20,               // C0..C1 any
+    ul__U8OVER4  = 0x40,               // F0 80..8F, F5..FF 80..8F
+    ul__U8CONTS  = 0x80,               // Continuation after continuation
+    ul__U8CARRY  = ul__U8SHORT | ul__U8LONG | ul__U8CONTS
+};
+
+static inline const unsigned char (*ul__utf8_tables(void))[16] {
+    static const unsigned char t[3][16] = {
+        {   // First byte, high nibble
+            ul__U8LONG, ul__U8LONG, ul__U8LONG, ul__U8LONG,
+            ul__U8LONG, ul__U8LONG, ul__U8LONG, ul__U8LONG,
+            ul__U8CONTS, ul__U8CONTS, ul__U8CONTS, ul__U8CONTS,
+            ul__U8SHORT | ul__U8OVER2,
+            ul__U8SHORT,
+            ul__U8SHORT | ul__U8OVER3 | ul__U8SURR,
+            ul__U8SHORT | ul__U8LARGE | ul__U8OVER4
+        },
+        {   // First byte, low nibble
+            ul__U8CARRY | ul__U8OVER3 | ul__U8OVER2 | ul__U8OVER4,
+            ul__U8CARRY | ul__U8OVER2,
+            ul__U8CARRY,
+            ul__U8CARRY,
+            ul__U8CARRY | ul__U8LARGE,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4 | ul__U8SURR,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4,
+            ul__U8CARRY | ul__U8LARGE | ul__U8OVER4
+        },
+        {   // Second byte, high nibble
+            ul__U8SHORT, ul__U8SHORT, ul__U8SHORT, ul__U8SHORT,
+            ul__U8SHORT, ul__U8SHORT, ul__U8SHORT, ul__U8SHORT,
+            ul__U8LONG | ul__U8OVER2 | ul__U8CONTS | ul__U8OVER3 | ul__U8OVER4,
+            ul__U8LONG | ul__U8OVER2 | ul__U8CONTS | ul__U8OVER3 | ul__U8LARGE,
+            ul__U8LONG | ul__U8OVER2 | ul__U8CONTS | ul__U8SURR  | ul__U8LARGE,
+            ul__U8LONG | ul__U8OVER2 | ul__U8CONTS | ul__U8SURR  | ul__U8LARGE,
+            ul__U8SHORT, ul__U8SHORT, ul__U8SHORT, ul__U8SHORT
+        }
+    };
+    return t;
+}
+
+#endif
+
+
+#ifdef ulHAVEAVX2
+
+// Nonzero bytes where the block in (preceded by prev) is invalid. A third or
+// fourth byte must be a continuation exactly when the pair check flags it
+// as one continuation following another, so the two cancel out under XOR.
+static inline __m256i ul__utf8_check32(__m256i in, __m256i prev, const __m256i t[3]) {
+    const __m256i lo = _mm256_set1_epi8(0x0F);
+    __m256i pp = _mm256_permute2x128_si256(prev, in, 0x21);
+    __m256i p1 = _mm256_alignr_epi8(in, pp, 15);
+    __m256i p2 = _mm256_alignr_epi8(in, pp, 14);
+    __m256i p3 = _mm256_alignr_epi8(in, pp, 13);
+    __m256i sc = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(t[0], _mm256_and_si256(_mm256_srli_epi16(p1, 4), lo)),
+            _mm256_shuffle_epi8(t[1], _mm256_and_si256(p1, lo))),
+        _mm256_shuffle_epi8(t[2], _mm256_and_si256(_mm256_srli_epi16(in, 4), lo)));
+    __m256i m23 = _mm256_or_si256(_mm256_subs_epu8(p2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                  _mm256_subs_epu8(p3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm256_xor_si256(_mm256_and_si256(m23, _mm256_set1_epi8((char)0x80)), sc);
+}
+
+// Offset of a sequence boundary before which s is known to be valid
+static inline size_t ul__utf8_validate_v32(const unsigned char *s, size_t n) {
+    const unsigned char (*tb)[16] = ul__utf8_tables();
+    const __m256i t[3] = {
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tb[0])),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tb[1])),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tb[2]))
+    };
+    // Bytes that leave a sequence open at the end of a block
+    const __m256i open = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m256i prev = _mm256_setzero_si256(), e;
+    size_t i = 0;
+
+    for (; n - i >= 32; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (!_mm256_movemask_epi8(in)) {
+            e = _mm256_subs_epu8(prev, open);
+            if (!_mm256_testz_si256(e, e)) break;
+        }
+        else {
+            e = ul__utf8_check32(in, prev, t);
+            if (!_mm256_testz_si256(e, e)) break;
+        }
+        prev = in;
+    }
+
+    return ul__utf8_syncback(s, i);
+}
+
+#elif defined( ulHAVESSSE3 )
+
+static inline __m128i ul__utf8_check16(__m128i in, __m128i prev, const __m128i t[3]) {
+    const __m128i lo = _mm_set1_epi8(0x0F);
+    __m128i p1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i p2 = _mm_alignr_epi8(in, prev, 14);
+    __m128i p3 = _mm_alignr_epi8(in, prev, 13);
+    __m128i sc = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(t[0], _mm_and_si128(_mm_srli_epi16(p1, 4), lo)),
+            _mm_shuffle_epi8(t[1], _mm_and_si128(p1, lo))),
+        _mm_shuffle_epi8(t[2], _mm_and_si128(_mm_srli_epi16(in, 4), lo)));
+    __m128i m23 = _mm_or_si128(_mm_subs_epu8(p2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                               _mm_subs_epu8(p3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm_xor_si128(_mm_and_si128(m23, _mm_set1_epi8((char)0x80)), sc);
+}
+
+static inline size_t ul__utf8_validate_v16(const unsigned char *s, size_t n) {
+    const unsigned char (*tb)[16] = ul__utf8_tables();
+    const __m128i t[3] = {
+        _mm_loadu_si128((const __m128i *)tb[0]),
+        _mm_loadu_si128((const __m128i *)tb[1]),
+        _mm_loadu_si128((const __m128i *)tb[2])
+    };
+    const __m128i open = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    const __m128i z = _mm_setzero_si128();
+    __m128i prev = z, e;
+    size_t i = 0;
+
+    for (; n - i >= 16; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(s + i));
+        e = _mm_movemask_epi8(in) ? ul__utf8_check16(in, prev, t)
+                                  : _mm_subs_epu8(prev, open);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(e, z)) != 0xFFFF) break;
+        prev = in;
+    }
+
+    return ul__utf8_syncback(s, i);
+}
+
+#endif
+
+
+static inline size_t ulutf8_validate(const unsigned char *s, size_t n) {
+    size_t i = 0;
+    int32_t c;
+    int k;
+
+#if defined( ulHAVEAVX2 )
+    i = ul__utf8_validate_v32(s, n);
+#elif defined( ulHAVESSSE3 )
+    i = ul__utf8_validate_v16(s, n);
+#endif
+
+    while (i < n) {
+        if (s[i] <= 0x7F) {
+            i += ul__ascii_span(s + i, n - i);
+            continue;
+        }
+        if ((k = ul__utf8_decode1(s + i, n - i, &c)) == 0) return i;
+        i += (size_t)k;
+    }
+
+    return n;
+}
+
+
+static inline size_t ulutf8_count(const unsigned char *s, size_t n) {
+    size_t i = 0, c = 0;
+
+#ifdef ulHAVEAVX2
+    // Per-byte counters are flushed into 64-bit sums before they can wrap
+    if (n >= 32) {
+        const __m256i cont = _mm256_set1_epi8(-65), z = _mm256_setzero_si256();
+        __m256i sum = z;
+        uint64_t lanes[4];
+        while (n - i >= 32) {
+            __m256i acc = z;
+            size_t blocks = (n - i) / 32 < 255 ? (n - i) / 32 : 255;
+            for (; blocks; blocks--, i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+                acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, cont));
+            }
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, z));
+        }
+        _mm256_storeu_si256((__m256i *)lanes, sum);
+        c = (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    if (n - i >= 16) {
+        const __m128i cont = _mm_set1_epi8(-65), z = _mm_setzero_si128();
+        __m128i sum = z;
+        uint64_t lanes[2];
+        while (n - i >= 16) {
+            __m128i acc = z;
+            size_t blocks = (n - i) / 16 < 255 ? (n - i) / 16 : 255;
+            for (; blocks; blocks--, i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, cont));
+            }
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, z));
+        }
+        _mm_storeu_si128((__m128i *)lanes, sum);
+        c += (size_t)(lanes[0] + lanes[1]);
+    }
+#endif
+
+    for (; i < n; i++) c += (s[i] & 0xC0) != 0x80;
+    return c;
+}
+
+
+static inline size_t ulutf8_offset(const unsigned char *s, size_t n, size_t k) {
+    size_t i = 0, c;
+    uint32_t m;
+
+#ifdef ulHAVEAVX2
+    for (; n - i >= 32; i += 32, k -= c) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65)));
+        if ((c = (size_t)ul__popcnt32(m)) > k) goto found;
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    for (; n - i >= 16; i += 16, k -= c) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        m = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65)));
+        if ((c = (size_t)ul__popcnt32(m)) > k) goto found;
+    }
+#endif
+
+    for (; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80 && k-- == 0) return i;
+    }
+    return n;
+
+#if defined( ulHAVESSE2 ) || defined( ulHAVEAVX2 )
+found:
+    for (; k; k--) m &= m - 1;
+    return i + (size_t)ul__ctz32(m);
+#else
+    (void)c; (void)m;
+#endif
+}
+
+
+static inline ulutf8index *ulutf8index_create(const unsigned char *s, size_t n, size_t stride) {
+    size_t nc = ulutf8_count(s, n), ns, j;
+    ulutf8index *ix;
+
+    if (stride == 0) stride = ulUTF8INDEXSTRIDE;
+    ns = nc / stride + 1;
+    if ((ix = malloc(sizeof *ix + ns * sizeof ix->off[0])) == NULL) return NULL;
+
+    ix->s = s;
+    ix->n = n;
+    ix->ncdpts = nc;
+    ix->stride = stride;
+    ix->off[0] = ulutf8_offset(s, n, 0);
+    for (j = 1; j < ns; j++) {
+        size_t o = ix->off[j-1];
+        ix->off[j] = o + ulutf8_offset(s + o, n - o, stride);
+    }
+    return ix;
+}
+
+static inline size_t ulutf8index_offset(const ulutf8index *ix, size_t k) {
+    size_t o;
+    if (k >= ix->ncdpts) return ix->n;
+    o = ix->off[k / ix->stride];
+    return o + ulutf8_offset(ix->s + o, ix->n - o, k % ix->stride);
+}
+
+static inline void ulutf8index_destroy(ulutf8index *ix) {
+    (free)(ix);
+}
+
+
+
+// Streaming UTF-16 <-> UTF-8 Transcoding
+// --------------------------------------
+// A zeroed ulutfstream carries state between chunks: a high surrogate or a
+// partial UTF-8 sequence left at the end of one chunk is completed by the
+// start of the next. Each *_chunk() call writes straight into dst and stops
+// at the end of input or when the next character would not fit; unconsumed
+// input (src + nread) must be passed again on the next call. Malformed input
+// is replaced with '?', as ulcdpt_from_utf16() does. At end of stream, the
+// matching *_flush() emits '?' for any dangling partial character. ASCII
+// runs are vectorized; other BMP text takes a tight scalar path.
+
+typedef struct ulutfstream {
+    unsigned char u8[4];               // Partial UTF-8 sequence carried over
+    unsigned int  nu8;                 // Bytes held in u8
+    uint16_t      hi;                  // High surrogate carried over, or 0
+} ulutfstream;
+
+
+// Length of the longest valid prefix of a UTF-8 sequence within s[0..n),
+// with the length the full sequence needs stored in *need. Returns 0 if s[0]
+// cannot begin a sequence.
+static inline int ul__utf8_prefix(const unsigned char *s, size_t n, int *need) {
+    unsigned char b = s[0], lo = 0x80, hi = 0xBF;
+    int k;
+
+    if      (b <= 0x7F)               { *need = 1; return 1; }
+    else if (0xC2 <= b && b <= 0xDF)  { *need = 2; }
+    else if (0xE0 <= b && b <= 0xEF)  { *need = 3; if (b == 0xE0) lo = 0xA0;
+                                                    if (b == 0xED) hi = 0x9F; }
+    else if (0xF0 <= b && b <= 0xF4)  { *need = 4; if (b == 0xF0) lo = 0x90;
+                                                    if (b == 0xF4) hi = 0x8F; }
+    else                              { *need = 1; return 0; }
+
+    if (n < 2 || s[1] < lo || hi < s[1]) return 1;
+    for (k = 2; k < *need && (size_t)k < n && (s[k] & 0xC0) == 0x80; k++);
+    return k;
+}
+
+
+// Widen/narrow a run of ASCII between UTF-8 and UTF-16. Returns run length.
+static inline size_t ul__ascii_to_utf16(const unsigned char *s, size_t n,
+                                        uint16_t *d, size_t cap) {
+    size_t i = 0;
+    if (cap < n) n = cap;
+
+#ifdef ulHAVEAVX2
+    while (i + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (_mm256_movemask_epi8(v)) break;
+        _mm256_storeu_si256((__m256i *)(d + i),
+            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + i))));
+        _mm256_storeu_si256((__m256i *)(d + i + 16),
+            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + i + 16))));
+        i += 32;
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(v)) break;
+        _mm_storeu_si128((__m128i *)(d + i),     _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(d + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+        i += 16;
+    }
+#endif
+
+    while (i < n && s[i] <= 0x7F) {
+        d[i] = s[i];
+        i++;
+    }
+
+    return i;
+}
+
+static inline size_t ul__utf16_to_ascii(const uint16_t *s, size_t n,
+                                        unsigned char *d, size_t cap) {
+    size_t i = 0;
+    if (cap < n) n = cap;
+
+#ifdef ulHAVEAVX2
+    while (i + 32 <= n) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 16));
+        __m256i m = _mm256_and_si256(_mm256_or_si256(a, b), _mm256_set1_epi16((short)0xFF80));
+        if (!_mm256_testz_si256(m, m)) break;
+        _mm256_storeu_si256((__m256i *)(d + i),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+        i += 32;
+    }
+#endif
+
+#ifdef ulHAVESSE2
+    while (i + 16 <= n) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 8));
+        __m128i m = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xFF80));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) != 0xFFFF) break;
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(a, b));
+        i += 16;
+    }
+#endif
+
+    while (i < n && s[i] <= 0x7F) {
+        d[i] = (unsigned char)s[i];
+        i++;
+    }
+
+    return i;
+}
+
+
+static inline ulutfresult ulutf16_from_utf8_chunk(ulutfstream *st,
+                                                  const unsigned char *src, size_t len,
+                                                  uint16_t *dst, size_t dstcap) {
+    size_t i = 0, o = 0;
+    int32_t c;
+    int n, need;
+
+    // Finish a sequence carried over from the previous chunk
+    if (st->nu8) {
+        unsigned char t[4];
+        size_t k = st->nu8, take = 4 - k < len ? 4 - k : len;
+        memcpy(t, st->u8, k);
+        memcpy(t + k, src, take);
+        n = ul__utf8_prefix(t, k + take, &need);
+
+        if (n == need) {
+            if (dstcap < (size_t)(need == 4 ? 2 : 1)) return (ulutfresult){ 0, 0 };
+            ul__utf8_decode1(t, (size_t)n, &c);
+            if (c > 0xFFFF) { ulutf16_from_cdpt(c, &dst[0], &dst[1]); o = 2; }
+            else            { dst[0] = (uint16_t)c;                   o = 1; }
+        }
+        else if ((size_t)n == k + take) {      // Still incomplete
+            memcpy(st->u8 + k, src, take);
+            st->nu8 = (unsigned int)n;
+            return (ulutfresult){ take, 0 };
+        }
+        else {
+            if (dstcap < 1) return (ulutfresult){ 0, 0 };
+            dst[o++] = '?';
+        }
+        i = (size_t)n - k;
+        st->nu8 = 0;
+    }
+
+    while (i < len && o < dstcap) {
+        if (src[i] <= 0x7F) {
+            size_t run = ul__ascii_to_utf16(src + i, len - i, dst + o, dstcap - o);
+            i += run;
+            o += run;
+            continue;
+        }
+
+        if ((n = ul__utf8_decode1(src + i, len - i, &c)) != 0) {
+            if (c > 0xFFFF) {
+                if (dstcap - o < 2) break;
+                ulutf16_from_cdpt(c, &dst[o], &dst[o + 1]);
+                o += 2;
+            }
+            else dst[o++] = (uint16_t)c;
+            i += (size_t)n;
+            continue;
+        }
+
+        n = ul__utf8_prefix(src + i, len - i, &need);
+        if (n && i + (size_t)n == len) {       // Truncated by end of chunk
+            memcpy(st->u8, src + i, (size_t)n);
+            st->nu8 = (unsigned int)n;
+            i = len;
+            break;
+        }
+        dst[o++] = '?';
+        i += n ? (size_t)n : 1;
+    }
+
+    return (ulutfresult){ i, o };
+}
+
+
+static inline ulutfresult ulutf8_from_utf16_chunk(ulutfstream *st,
+                                                  const uint16_t *src, size_t len,
+                                                  unsigned char *dst, size_t dstcap) {
+    size_t i = 0, o = 0;
+    uint16_t u;
+
+    // Finish a surrogate pair carried over from the previous chunk
+    if (st->hi && len) {
+        if (0xDC00 <= src[0] && src[0] <= 0xDFFF) {
+            if (dstcap < 4) return (ulutfresult){ 0, 0 };
+            o = (size_t)ul__utf8_encode1(ulcdpt_from_utf16(st->hi, src[0]), dst);
+            i = 1;
+        }
+        else {
+            if (dstcap < 1) return (ulutfresult){ 0, 0 };
+            dst[o++] = '?';
+        }
+        st->hi = 0;
+    }
+
+    while (i < len && o < dstcap) {
+        u = src[i];
+
+        if (u <= 0x7F) {
+            size_t run = ul__utf16_to_ascii(src + i, len - i, dst + o, dstcap - o);
+            i += run;
+            o += run;
+            continue;
+        }
+
+        if (u <= 0x7FF) {
+            if (dstcap - o < 2) break;
+            dst[o++] = (unsigned char)((u >> 6  & 0x1F) | 0xC0);
+            dst[o++] = (unsigned char)((u       & 0x3F) | 0x80);
+            i++;
+        }
+        else if (u < 0xD800 || 0xDFFF < u) {
+            if (dstcap - o < 3) break;
+            dst[o++] = (unsigned char)((u >> 12 & 0x0F) | 0xE0);
+            dst[o++] = (unsigned char)((u >> 6  & 0x3F) | 0x80);
+            dst[o++] = (unsigned char)((u       & 0x3F) | 0x80);
+            i++;
+        }
+        else if (u <= 0xDBFF && i + 1 == len) {   // Pair split by end of chunk
+            st->hi = u;
+            i++;
+        }
+        else if (u <= 0xDBFF && 0xDC00 <= src[i+1] && src[i+1] <= 0xDFFF) {
+            if (dstcap - o < 4) break;
+            o += (size_t)ul__utf8_encode1(ulcdpt_from_utf16(u, src[i+1]), dst + o);
+            i += 2;
+        }
+        else {                                    // Unpaired surrogate
+            dst[o++] = '?';
+            i++;
+        }
+    }
+
+    return (ulutfresult){ i, o };
+}
+
+
+static inline size_t ulutf16_from_utf8_flush(ulutfstream *st, uint16_t *dst, size_t dstcap) {
+    if (!st->nu8 || dstcap < 1) return 0;
+    st->nu8 = 0;
+    dst[0] = '?';
+    return 1;
+}
+
+static inline size_t ulutf8_from_utf16_flush(ulutfstream *st, unsigned char *dst, size_t dstcap) {
+    if (!st->hi || dstcap < 1) return 0;
+    st->hi = 0;
+    dst[0] = '?';
+    return 1;
 }
 
 #endif
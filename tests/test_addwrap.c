@@ -0,0 +1,95 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Checks uladdwrap(), uladdwrap_n() and uladdwrap_reduce() on every pair of
+// 8-bit and 16-bit operands against a reference that adds in long long and
+// folds the sum back into range. The 8-bit types are char, signed char and
+// unsigned char (as plain char under -funsigned-char). Each result is also
+// read back through the matching unsigned type and compared with the unsigned
+// sum modulo 2^8 or 2^16, since two's complement addition is the same on both
+// and callers use the signed functions for unsigned data. The Makefile builds
+// this file with signed and unsigned plain char, with and without ulNOSIMD,
+// so both the scalar and the vector paths are covered. uladdwrap_n() runs a
+// whole row of b values against one a, which also exercises the scalar tail
+// after the vector blocks; uladdwrap_reduce() runs on {a, b}, which is below
+// any vector width and so always takes the scalar path.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "addwrap.h"
+
+static unsigned long failures;
+
+static long long wrapref(long long a, long long b,
+                         long long min, long long max) {
+    long long s = a + b, span = max - min + 1;
+    if (s > max) s -= span;
+    if (s < min) s += span;
+    return s;
+}
+
+static void fail(const char *type, const char *fn, long long a, long long b,
+                 long long got, long long want) {
+    if (failures++ < 10)
+        fprintf(stderr, "%s %s(%lld, %lld) = %lld, want %lld\n",
+                type, fn, a, b, got, want);
+}
+
+#define CHECKPAIRS(T, UT, MIN, MAX) do {                                      \
+    static T row_a[(MAX) - (MIN) + 1], row_b[(MAX) - (MIN) + 1],              \
+             row_d[(MAX) - (MIN) + 1];                                        \
+    const size_t nrow = (size_t)((MAX) - (MIN) + 1);                          \
+    for (size_t k = 0; k < nrow; k++) row_b[k] = (T)((MIN) + (long long)k);   \
+    for (long long a = (MIN); a <= (MAX); a++) {                              \
+        for (size_t k = 0; k < nrow; k++) row_a[k] = (T)a;                    \
+        uladdwrap_n(row_d, row_a, row_b, nrow);                               \
+        for (long long b = (MIN); b <= (MAX); b++) {                          \
+            long long want = wrapref(a, b, (MIN), (MAX));                     \
+            UT uwant = (UT)((UT)a + (UT)b);                                   \
+            T pair[2] = { (T)a, (T)b };                                       \
+            T s = uladdwrap((T)a, (T)b);                                      \
+            T n = row_d[b - (MIN)];                                           \
+            T r = uladdwrap_reduce(pair, 2);                                  \
+            if (s != want) fail(#T, "uladdwrap", a, b, s, want);              \
+            if (n != want) fail(#T, "uladdwrap_n", a, b, n, want);            \
+            if (r != want) fail(#T, "uladdwrap_reduce", a, b, r, want);       \
+            if ((UT)s != uwant || (UT)n != uwant || (UT)r != uwant)           \
+                fail(#UT, "uladdwrap*", (UT)a, (UT)b, (UT)s, uwant);          \
+        }                                                                     \
+    }                                                                         \
+} while (0)
+
+
+int main(void) {
+    CHECKPAIRS(char, unsigned char, CHAR_MIN, CHAR_MAX);
+    CHECKPAIRS(signed char, unsigned char, SCHAR_MIN, SCHAR_MAX);
+    CHECKPAIRS(short, unsigned short, SHRT_MIN, SHRT_MAX);
+
+    printf("test_addwrap (%s char, %s): %s\n",
+           CHAR_MIN < 0 ? "signed" : "unsigned",
+#ifdef ulNOSIMD
+           "scalar",
+#else
+           "vector",
+#endif
+           failures ? "FAIL" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
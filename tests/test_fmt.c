@@ -0,0 +1,100 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Compares ulfmt_double() with snprintf("%f"). Near-tie values are the
+// hard part: each decimal tie k + m/1e6 + 0.5e-6 is tried as the nearest
+// double and the few doubles on either side of it, across magnitudes from
+// 1e-6 to 1e15, along with random doubles, special values, and values that
+// carry into the integer part.
+
+#include <math.h>
+#include "utillib.h"
+
+#define NTIES    500000
+#define NRANDOM  500000
+#define NEIGHBOR 3
+
+static unsigned long failures, checked;
+
+static void check(double v) {
+    char want[400], got[400];
+    ulfmtbuf b;
+
+    snprintf(want, sizeof want, "%f", v);
+    ulfmt_init(&b, got, sizeof got - 1);
+    ulfmt_double(&b, v);
+    got[ulfmt_len(&b)] = '\0';
+    checked++;
+    if (strcmp(got, want) && failures++ < 10)
+        fprintf(stderr, "ulfmt_double(%.17g) = %s, want %s\n", v, got, want);
+}
+
+static void checkaround(double v) {
+    double lo = v, hi = v;
+    check(v);
+    for (int i = 0; i < NEIGHBOR; i++) {
+        check(lo = nextafter(lo, -INFINITY));
+        check(hi = nextafter(hi, INFINITY));
+    }
+}
+
+static unsigned long long rnd(void) {
+    static unsigned long long s = 0x9E3779B97F4A7C15ULL;
+    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+    return s;
+}
+
+
+int main(void) {
+    static const double fixed[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, 0.0000005, 0.0000015, 0.0000025,
+        2.5000000000000002e-06, 1.4047075, 0.9999995, 0.99999949999999,
+        9.9999995, 999999999999999.9, 1e15, 1e15 - 0.125, 1e300, 5e-324,
+        123456.7890125, 0.1, 0.2, 0.3,
+    };
+
+    for (size_t i = 0; i < sizeof fixed / sizeof *fixed; i++) {
+        checkaround(fixed[i]);
+        checkaround(-fixed[i]);
+    }
+    check(NAN);
+    check(INFINITY);
+    check(-INFINITY);
+
+    // Decimal ties with integer parts of 0 to 15 digits
+    for (long i = 0; i < NTIES; i++) {
+        unsigned long long ip = rnd() % 1000000000000000ULL;
+        ip /= (unsigned long long)pow(10, (double)(rnd() % 16));
+        checkaround((double)ip + ((double)(rnd() % 1000000) + 0.5) / 1e6);
+    }
+
+    // Random bit patterns up to 1e16, so both sides of 1e15 are covered
+    for (long i = 0; i < NRANDOM; i++) {
+        double v;
+        unsigned long long u = rnd();
+        memcpy(&v, &u, sizeof v);
+        if (v != v || fabs(v) > 1e16) v = fmod(v, 1e16);
+        if (v == v) check(v);
+    }
+
+    printf("test_fmt: %lu values, %s\n", checked, failures ? "FAIL" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
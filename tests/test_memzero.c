@@ -0,0 +1,84 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// ulmemzerosecure() must survive dead-store elimination. handle_secret()
+// fills a stack buffer with a known pattern, zeroes it, and returns without
+// reading it again, so an optimizer may drop the zeroing. scan_stack() then
+// reads the same stack region back and counts copies of the pattern. The
+// Makefile builds this file with -O3 -flto, once with -std=gnu11 and once
+// with -std=c11, which covers both the explicit_bzero() path (where glibc
+// has it) and the memset-plus-barrier path. A plain memset() run is the
+// control: it shows whether the stack really is reused, and is reported but
+// never fails the test.
+
+#include "utillib.h"
+
+#define SECRETSZ 4096
+
+static const char pattern[] = "ul-secret-7f3a9c";
+
+
+__attribute__((noinline)) static void handle_secret(int secure) {
+    char secret[SECRETSZ];
+    volatile char sink = 0;
+
+    for (size_t i = 0; i < SECRETSZ; i++) secret[i] = pattern[i % (sizeof pattern - 1)];
+    for (size_t i = 0; i < SECRETSZ; i += 64) sink ^= secret[i];
+
+    if (secure) ulmemzerosecure(secret, sizeof secret);
+    else        memset(secret, 0, sizeof secret);
+}
+
+// Reads indeterminate stack contents on purpose, through a volatile pointer
+__attribute__((noinline)) static size_t scan_stack(void) {
+    unsigned char probe[4 * SECRETSZ];
+    volatile unsigned char *v = probe;
+    size_t hits = 0;
+
+    for (size_t i = 0; i + 16 <= sizeof probe; i++) {
+        size_t k = 0;
+        while (k < 16 && v[i + k] == (unsigned char)pattern[k]) k++;
+        hits += (k == 16);
+    }
+    return hits;
+}
+
+
+int main(void) {
+#if defined( __STDC_LIB_EXT1__ ) && defined( __STDC_WANT_LIB_EXT1__ )
+    const char *path = "memset_s";
+#elif defined( ulHAVEEXPLICITBZERO )
+    const char *path = "explicit_bzero";
+#else
+    const char *path = "memset+barrier";
+#endif
+    size_t control, left;
+
+    handle_secret(0);
+    control = scan_stack();
+    handle_secret(1);
+    left = scan_stack();
+
+    printf("test_memzero (%s): %zu copies left by memset, %zu by ulmemzerosecure\n",
+           path, control, left);
+    if (control == 0) printf("test_memzero: stack not reused; the check is inconclusive\n");
+    return left == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,184 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Checks the saturating and checked operations of satcheck.h against a
+// reference that computes the exact result in __int128 and then clamps or
+// wraps it. 8-bit types are checked on every pair of operands, 16-bit types
+// on every a against a stride of b values plus those near 0 and the limits,
+// and 32- and 64-bit types on every pair drawn from their limits and small
+// values near them, plus random pairs. uladdsat_n() and ulsubsat_n() run on
+// arrays of every length up to a few vector blocks, so both the vector loop
+// and the scalar tail are compared against the scalar functions. The
+// Makefile builds this file with the default instruction set, with
+// -march=native, and with ulNOSIMD.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "satcheck.h"
+
+#define NRANDOM  200000
+#define MAXN     67
+#define NARRAY   (1 << 20)
+#define NEAR     64
+
+typedef __int128 wide;
+typedef unsigned __int128 uwide;
+
+static unsigned long failures;
+
+static wide clampref(wide x, wide min, wide max) {
+    return x < min ? min : x > max ? max : x;
+}
+
+// Wraps a sum or difference, which is off by at most one span
+static wide wrapref(wide x, wide min, wide max) {
+    wide span = max - min + 1;
+    return x < min ? x + span : x > max ? x - span : x;
+}
+
+static void fail(const char *type, const char *fn, wide a, wide b,
+                 wide got, wide want) {
+    if (failures++ < 10)
+        fprintf(stderr, "%s %s(%lld, %lld) = %lld, want %lld\n", type, fn,
+                (long long)a, (long long)b, (long long)got, (long long)want);
+}
+
+static unsigned long long rnd(void) {
+    static unsigned long long s = 0x9E3779B97F4A7C15ULL;
+    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+    return s;
+}
+
+// Scalar checks of one pair against the reference
+#define CHECKPAIR(T, MIN, MAX, a, b) do {                                     \
+    T a_ = (a), b_ = (b), r_;                                                 \
+    wide s_ = (wide)a_ + b_, d_ = (wide)a_ - b_, p_;                          \
+    uwide pu_ = (uwide)(wide)a_ * (uwide)(wide)b_;                            \
+    int o_;                                                                   \
+    /* An unsigned 64-bit product can exceed wide; only its excess matters */ \
+    p_ = (MIN) < 0 ? (wide)a_ * b_                                             \
+                   : pu_ > (uwide)(MAX) ? (wide)(MAX) + 1 : (wide)pu_;        \
+    if ((r_ = uladdsat(a_, b_)) != clampref(s_, MIN, MAX))                    \
+        fail(#T, "uladdsat", a_, b_, r_, clampref(s_, MIN, MAX));             \
+    if ((r_ = ulsubsat(a_, b_)) != clampref(d_, MIN, MAX))                    \
+        fail(#T, "ulsubsat", a_, b_, r_, clampref(d_, MIN, MAX));             \
+    if ((r_ = ulmulsat(a_, b_)) != clampref(p_, MIN, MAX))                    \
+        fail(#T, "ulmulsat", a_, b_, r_, clampref(p_, MIN, MAX));             \
+    o_ = uladdcheck(a_, b_, &r_);                                             \
+    if (r_ != wrapref(s_, MIN, MAX) || o_ != (s_ < (MIN) || s_ > (MAX)))      \
+        fail(#T, "uladdcheck", a_, b_, r_, wrapref(s_, MIN, MAX));            \
+    o_ = ulsubcheck(a_, b_, &r_);                                             \
+    if (r_ != wrapref(d_, MIN, MAX) || o_ != (d_ < (MIN) || d_ > (MAX)))      \
+        fail(#T, "ulsubcheck", a_, b_, r_, wrapref(d_, MIN, MAX));            \
+    o_ = ulmulcheck(a_, b_, &r_);                                             \
+    if (r_ != (T)pu_ || o_ != (p_ < (MIN) || p_ > (MAX)))                     \
+        fail(#T, "ulmulcheck", a_, b_, r_, (T)pu_);                           \
+} while (0)
+
+// Array checks: dst against the scalar functions, running consecutive blocks
+// of xs and ys with every length from 0 to MAXN in turn
+#define CHECKARRAY(T, xs, ys, count) do {                                     \
+    T d_[MAXN];                                                               \
+    for (size_t off = 0, n = 0; off + MAXN <= (count);                        \
+         off += n, n = (n + 1) % (MAXN + 1)) {                                \
+        uladdsat_n(d_, (xs) + off, (ys) + off, n);                            \
+        for (size_t k = 0; k < n; k++)                                        \
+            if (d_[k] != uladdsat((xs)[off + k], (ys)[off + k]))              \
+                fail(#T, "uladdsat_n", (xs)[off + k], (ys)[off + k],          \
+                     d_[k], uladdsat((xs)[off + k], (ys)[off + k]));          \
+        ulsubsat_n(d_, (xs) + off, (ys) + off, n);                            \
+        for (size_t k = 0; k < n; k++)                                        \
+            if (d_[k] != ulsubsat((xs)[off + k], (ys)[off + k]))              \
+                fail(#T, "ulsubsat_n", (xs)[off + k], (ys)[off + k],          \
+                     d_[k], ulsubsat((xs)[off + k], (ys)[off + k]));          \
+    }                                                                         \
+} while (0)
+
+// Pairs of a narrow type through the scalar forms: every a against every b
+// that is a multiple of STEP above MIN or within NEAR of 0 or a limit. The
+// first NARRAY of them, then as many random pairs, go through the array forms.
+#define CHECKNARROW(T, MIN, MAX, STEP) do {                                   \
+    static T xs_[NARRAY], ys_[NARRAY], bs_[(MAX) - (MIN) + 1];                \
+    size_t m_ = 0, nb_ = 0;                                                   \
+    for (long b = (MIN); b <= (MAX); b++)                                     \
+        if ((b - (MIN)) % (STEP) == 0 || b - (MIN) <= NEAR ||                 \
+            (MAX) - b <= NEAR || (b >= -NEAR && b <= NEAR)) bs_[nb_++] = (T)b; \
+    for (long a = (MIN); a <= (MAX); a++)                                     \
+        for (size_t j = 0; j < nb_; j++) {                                    \
+            CHECKPAIR(T, MIN, MAX, (T)a, bs_[j]);                             \
+            if (m_ < NARRAY) { xs_[m_] = (T)a; ys_[m_] = bs_[j]; m_++; }      \
+        }                                                                     \
+    CHECKARRAY(T, xs_, ys_, m_);                                              \
+    for (size_t k = 0; k < m_; k++) {                                         \
+        xs_[k] = (T)((MIN) + (long)(rnd() % ((MAX) - (MIN) + 1UL)));           \
+        ys_[k] = (T)((MIN) + (long)(rnd() % ((MAX) - (MIN) + 1UL)));           \
+    }                                                                         \
+    CHECKARRAY(T, xs_, ys_, m_);                                              \
+} while (0)
+
+// Edge and random pairs of a wide type. Random operands are scaled down by
+// a random shift so that both overflowing and fitting results are common.
+#define CHECKWIDE(T, MIN, MAX) do {                                           \
+    static T xs_[NRANDOM], ys_[NRANDOM];                                      \
+    const T edge_[] = { (MIN), (MIN) + 1, (MIN) / 2, -1, 0, 1, 2,             \
+                        (MAX) / 2, (MAX) / 2 + 1, (MAX) - 1, (MAX) };         \
+    const size_t ne_ = sizeof edge_ / sizeof *edge_;                          \
+    size_t m_ = 0;                                                            \
+    for (size_t i = 0; i < ne_; i++)                                          \
+        for (size_t j = 0; j < ne_; j++) {                                    \
+            CHECKPAIR(T, MIN, MAX, edge_[i], edge_[j]);                       \
+            xs_[m_] = edge_[i]; ys_[m_] = edge_[j]; m_++;                     \
+        }                                                                     \
+    for (; m_ < NRANDOM; m_++) {                                              \
+        xs_[m_] = (T)rnd(); ys_[m_] = (T)rnd();                               \
+        if (rnd() & 1) xs_[m_] = (T)(xs_[m_] >> (rnd() % (8 * sizeof(T))));   \
+        if (rnd() & 1) ys_[m_] = (T)(ys_[m_] >> (rnd() % (8 * sizeof(T))));   \
+        CHECKPAIR(T, MIN, MAX, xs_[m_], ys_[m_]);                             \
+    }                                                                         \
+    CHECKARRAY(T, xs_, ys_, m_);                                              \
+} while (0)
+
+
+int main(void) {
+    CHECKNARROW(char, CHAR_MIN, CHAR_MAX, 1);
+    CHECKNARROW(signed char, SCHAR_MIN, SCHAR_MAX, 1);
+    CHECKNARROW(unsigned char, 0, UCHAR_MAX, 1);
+    CHECKNARROW(short, SHRT_MIN, SHRT_MAX, 61);
+    CHECKNARROW(unsigned short, 0, USHRT_MAX, 61);
+
+    CHECKWIDE(int, INT_MIN, INT_MAX);
+    CHECKWIDE(unsigned, 0, UINT_MAX);
+    CHECKWIDE(long, LONG_MIN, LONG_MAX);
+    CHECKWIDE(unsigned long, 0, ULONG_MAX);
+    CHECKWIDE(long long, LLONG_MIN, LLONG_MAX);
+    CHECKWIDE(unsigned long long, 0, ULLONG_MAX);
+
+    printf("test_satcheck (%s): %s\n",
+#if defined( ulHAVEAVX2 )
+           "avx2",
+#elif defined( ulHAVESSE2 )
+           "sse2",
+#else
+           "scalar",
+#endif
+           failures ? "FAIL" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
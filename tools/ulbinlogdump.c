@@ -0,0 +1,282 @@
+// ===========================================================================
+//
+//                                 Util Lib
+//    A collection of utilities to make C programming and debugging easier
+//
+// ---------------------------------------------------------------------------
+//
+//   Copyright (c) 2022 Joshua Lee Ockert <https://github.com/torstenvl/>
+//
+//   THIS WORK IS PROVIDED "AS IS" WITH NO WARRANTY OF ANY KIND. THE IMPLIED
+//   WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE
+//   EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW
+//   FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.
+//
+//   Permission to use, copy, modify, and/or distribute this work for any
+//   purpose is hereby granted, provided this notice appears in all copies.
+//
+//   SPDX-License-Identifier: ISC
+//
+// ===========================================================================
+
+// Render a binary log written in ulBINLOG mode as text, in timestamp order.
+// Must be built for the same platform as the program that wrote the log.
+//
+//     cc -std=c11 -O2 -Isrc -o ulbinlogdump tools/ulbinlogdump.c
+//     ./ulbinlogdump [ulbinlog.out]
+
+#define _POSIX_C_SOURCE 200809L
+#define ulCROWDEDNAMESPACE
+#define ulBINLOG
+#include "utillib.h"
+
+typedef struct site {
+    uint32_t    line;
+    const char *file, *func, *fmt;
+    uint16_t    filelen, funclen, fmtlen;
+} site;
+
+typedef struct event {
+    uint64_t             ns, tid;
+    size_t               seq;
+    uint32_t             id;
+    const unsigned char *args, *argend;
+} event;
+
+static site   *sites;
+static size_t  nsites;
+static event  *events;
+static size_t  nevents, capevents;
+
+
+static int byts(const void *a, const void *b) {
+    const event *x = a, *y = b;
+    if (x->ns != y->ns) return x->ns < y->ns ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+
+static unsigned char *slurp(const char *path, size_t *n) {
+    FILE *fp = fopen(path, "rb");
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+
+    if (!fp) return NULL;
+    *n = 0;
+    for (;;) {
+        if (*n == cap) {
+            unsigned char *nb = realloc(buf, cap = cap ? cap * 2 : 1 << 20);
+            if (!nb) { (free)(buf); fclose(fp); return NULL; }
+            buf = nb;
+        }
+        size_t got = fread(buf + *n, 1, cap - *n, fp);
+        if (got == 0) break;
+        *n += got;
+    }
+    fclose(fp);
+    return buf;
+}
+
+
+// Index sites and events from every chunk. Sites may appear after events
+// that use them (in another thread's chunk), so rendering waits for this.
+// Every record header and the lengths it declares are checked against the
+// end of its chunk first; a record that overruns it stops the scan.
+static int scan(const unsigned char *p, size_t n) {
+    size_t off = 0;
+
+    while (off + ulBINLOGCHUNKHDR <= n) {
+        uint32_t clen;
+        uint64_t tid;
+        size_t   r, end;
+
+        if (memcmp(p + off, "ULB1", 4)) return -1;
+        memcpy(&clen, p + off + 4, 4);
+        memcpy(&tid,  p + off + 8, 8);
+        if (clen < ulBINLOGCHUNKHDR || off + clen > n) return -1;
+        end = off + clen;
+
+        for (r = off + ulBINLOGCHUNKHDR; r < end; ) {
+            uint32_t id;
+            if (end - r < 5) return -1;
+            memcpy(&id, p + r + 1, 4);
+
+            if (p[r] == 'S') {
+                site s;
+                if (end - r < 15) return -1;
+                memcpy(&s.line,    p + r + 5,  4);
+                memcpy(&s.filelen, p + r + 9,  2);
+                memcpy(&s.funclen, p + r + 11, 2);
+                memcpy(&s.fmtlen,  p + r + 13, 2);
+                if (end - r - 15 < (size_t)s.filelen + s.funclen + s.fmtlen) return -1;
+                s.file = (const char *)p + r + 15;
+                s.func = s.file + s.filelen;
+                if ((s.fmt = malloc((size_t)s.fmtlen + 1)) == NULL) return -1;
+                memcpy((char *)s.fmt, s.func + s.funclen, s.fmtlen);
+                ((char *)s.fmt)[s.fmtlen] = '\0';
+                if (id >= nsites) {
+                    site *ns = realloc(sites, (id + 1) * sizeof *ns);
+                    if (!ns) return -1;
+                    memset(ns + nsites, 0, (id + 1 - nsites) * sizeof *ns);
+                    sites = ns;
+                    nsites = id + 1;
+                }
+                sites[id] = s;
+                r += 15 + (size_t)s.filelen + s.funclen + s.fmtlen;
+            }
+            else if (p[r] == 'E') {
+                uint32_t argz;
+                if (end - r < 17) return -1;
+                memcpy(&argz, p + r + 13, 4);
+                if (end - r - 17 < argz) return -1;
+                if (nevents == capevents) {
+                    event *ne = realloc(events, (capevents = capevents ? capevents * 2 : 4096) * sizeof *ne);
+                    if (!ne) return -1;
+                    events = ne;
+                }
+                memcpy(&events[nevents].ns, p + r + 5, 8);
+                events[nevents].tid    = tid;
+                events[nevents].seq    = nevents;
+                events[nevents].id     = id;
+                events[nevents].args   = p + r + 17;
+                events[nevents].argend = p + r + 17 + argz;
+                nevents++;
+                r += 17 + (size_t)argz;
+            }
+            else return -1;
+        }
+        off = end;
+    }
+
+    return 0;
+}
+
+
+_Pragma(PRAGMADIAGPUSH)
+_Pragma(PRAGMADIAGFMTLIT)
+
+// Copy the next n argument bytes to v, or return 0 if the event has fewer
+static int take(const unsigned char **a, const unsigned char *aend, void *v, size_t n) {
+    if ((size_t)(aend - *a) < n) return 0;
+    memcpy(v, *a, n);
+    *a += n;
+    return 1;
+}
+
+#define TAKE(v) if (!take(a, aend, &v, sizeof v)) goto short_args
+
+// Print one conversion spec with its recorded argument(s), advancing *a no
+// further than aend.
+static void render_spec(const char *spec, size_t speclen, const unsigned char *t,
+                        int nt, const unsigned char **a, const unsigned char *aend) {
+    char f[64], *q = f;
+    int  star = 0;
+
+    for (size_t i = 0; i < speclen && q < f + sizeof f - 24; i++) {
+        if (spec[i] == '*' && star < nt - 1) {
+            int v;
+            TAKE(v);
+            star++;
+            if (v < 0 && i > 0 && spec[i - 1] == '.') q--;    // No precision
+            else q += snprintf(q, 16, "%d", v);
+        }
+        else *q++ = spec[i];
+    }
+    *q = '\0';
+
+    switch (t[nt - 1]) {
+        case ulBL_INT:     { int         v; TAKE(v); printf(f, v); break; }
+        case ulBL_LONG:    { long        v; TAKE(v); printf(f, v); break; }
+        case ulBL_LLONG:   { long long   v; TAKE(v); printf(f, v); break; }
+        case ulBL_INTMAX:  { intmax_t    v; TAKE(v); printf(f, v); break; }
+        case ulBL_SIZE:    { size_t      v; TAKE(v); printf(f, v); break; }
+        case ulBL_PTRDIFF: { ptrdiff_t   v; TAKE(v); printf(f, v); break; }
+        case ulBL_DOUBLE:  { double      v; TAKE(v); printf(f, v); break; }
+        case ulBL_LDOUBLE: { long double v; TAKE(v); printf(f, v); break; }
+        case ulBL_STR: {
+            uint32_t z;
+            char    *str;
+            TAKE(z);
+            if ((size_t)(aend - *a) < z) goto short_args;
+            if ((str = malloc(z + 1)) != NULL) {
+                memcpy(str, *a, z);
+                str[z] = '\0';
+                printf(f, str);
+                (free)(str);
+            }
+            *a += z;
+            break;
+        }
+        default: {
+            void *v;
+            TAKE(v);
+            if (spec[speclen - 1] == 'p') printf(f, v);
+            else if (spec[speclen - 1] != 'n') printf("(%p)", v);
+            break;
+        }
+    }
+    return;
+
+short_args:
+    *a = aend;
+    printf("(missing argument)");
+}
+
+#undef TAKE
+
+_Pragma(PRAGMADIAGPOP)
+
+
+static void render(const event *e) {
+    const site *s = e->id < nsites ? &sites[e->id] : NULL;
+    const unsigned char *a = e->args;
+    const char *p, *end;
+    int used = 0;
+
+    printf("[%llu.%09llu T%llu] ", (unsigned long long)(e->ns / 1000000000U),
+           (unsigned long long)(e->ns % 1000000000U), (unsigned long long)e->tid);
+
+    if (!s || !s->fmt) {
+        printf("(unknown log site %u)\n", e->id);
+        return;
+    }
+
+    printf("In %.*s:%.*s() line %u: ", s->filelen, s->file, s->funclen, s->func, s->line);
+
+    for (p = s->fmt, end = s->fmt + s->fmtlen; p < end; ) {
+        if (*p != '%') { putchar(*p++); continue; }
+        if (p + 1 < end && p[1] == '%') { putchar('%'); p += 2; continue; }
+
+        unsigned char t[ulBINLOGMAXARGS];
+        int prec[ulBINLOGMAXARGS], nt = 0;
+        const char *q = ul__blog_spec(p, t, prec, &nt);
+        if (q > end) q = end;
+
+        if (nt > 0 && used + nt <= ulBINLOGMAXARGS)
+            render_spec(p, (size_t)(q - p), t, nt, &a, e->argend);
+        else printf("%.*s", (int)(q - p), p);
+        used += nt;
+        p = q;
+    }
+    putchar('\n');
+}
+
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : ulBINLOGPATH;
+    unsigned char *log;
+    size_t n;
+
+    if ((log = slurp(path, &n)) == NULL) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], path);
+        return EXIT_FAILURE;
+    }
+    if (scan(log, n) < 0) {
+        fprintf(stderr, "%s: %s is truncated or not a utillib binary log\n", argv[0], path);
+    }
+
+    if (nevents) qsort(events, nevents, sizeof *events, byts);
+    for (size_t i = 0; i < nevents; i++) render(&events[i]);
+
+    return EXIT_SUCCESS;
+}